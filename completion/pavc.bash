@@ -0,0 +1,10 @@
+# bash completion for pavc
+
+_pavc()
+{
+	local IFS=$'\n'
+
+	COMPREPLY=($(pavc --complete "${COMP_WORDS[@]:1:COMP_CWORD}" 2>/dev/null))
+}
+
+complete -F _pavc pavc
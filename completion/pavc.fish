@@ -0,0 +1,3 @@
+# fish completion for pavc
+
+complete -c pavc -f -a '(pavc --complete (commandline -opc)[2..-1] (commandline -ct) 2>/dev/null)'
@@ -5,6 +5,9 @@ VERSION = 1.1.0
 # paths
 PREFIX = /usr/local
 MANPREFIX = ${PREFIX}/share/man
+BASHCOMPDIR = ${PREFIX}/share/bash-completion/completions
+ZSHCOMPDIR = ${PREFIX}/share/zsh/site-functions
+FISHCOMPDIR = ${PREFIX}/share/fish/vendor_completions.d
 
 
 # Pulseaudio
@@ -16,23 +19,31 @@ PALIB = /usr/lib
 #ASANFLAGS = -fsanitize=address -fsanitize=undefined
 
 
+# native protocol backend, talks to the local server socket directly
+# (skips libpulse setup) for commands that don't need streams, libpulse
+# is still used as fallback (experimental, not yet validated or measured
+# against a real server, keep it disabled unless testing it)
+#NATIVEDEFS = -DPAVC_NATIVE
+
+
 # debug vars
 #DBGDEFS = -DPAVC_ASSERT
 #DBGFLAGS = -g
 
 
-# enables optimizations
-OPTS = -O2
+# enables optimizations (cheap cost model lets gcc vectorize the
+# meter and volume kernels at -O2, remove it for other compilers)
+OPTS = -O2 -fvect-cost-model=cheap
 
 
 # includes and libraries
 INCS = -I${PAINC}
-LIBS = -L${PALIB} -lpulse ${ASANFLAGS}
+LIBS = -L${PALIB} -lpulse -lm ${ASANFLAGS}
 
 
 # compiler and linker flags
 CPPFLAGS = -D_POSIX_SOURCE_200809L
-CFLAGS   = -std=c99 -Wpedantic -Wall -Wextra ${OPTS} ${DBGDEFS} ${DBGFLAGS} \
+CFLAGS   = -std=c99 -Wpedantic -Wall -Wextra ${OPTS} ${NATIVEDEFS} ${DBGDEFS} ${DBGFLAGS} \
 	   ${INCS} ${CPPFLAGS} ${ASANFLAGS}
 LDFLAGS  = ${LIBS}
 
@@ -16,21 +16,72 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "pcommon.h"
 #include "pstate.h"
 
 
 
+/* command phases with a deadline */
+enum { PHCONNECT, PHLIST, PHOP, PHNUM };
+
+
+typedef struct PavcCmd PavcCmd;
+
+
+typedef void (*Cmdfunction)(pavc_State *pavc, const pa_sink_info *si, PavcCmd *cmd);
+
+
+/* fills kernel operands for channels of 'si' (see 'pavc_volume_apply') */
+typedef void (*Planfunction)(const pa_sink_info *si, PavcCmd *cmd, float *mul, float *add);
+
+
+struct PavcCmd {
+	Cmdfunction fn;
+	union {
+		unsigned int n;
+		int i;
+		const char *str;
+	} val;
+	Planfunction plan; /* set if command runs as a batch */
+	float level[PA_CHANNEL_POSITION_MAX]; /* ('set') level of each position */
+	unsigned char haslevel[PA_CHANNEL_POSITION_MAX]; /* ('set') true if level is given */
+	const char *sinkname;
+	pavc_State *pavc;
+	unsigned char cacheable; /* true if command can run on cached sink */
+	unsigned char cached; /* true if running on cached sink */
+	unsigned char stale; /* true if cached sink turned out to be stale */
+	unsigned char opok; /* true if last operation succeeded */
+	unsigned char optstream; /* true if '-s' option was given */
+	unsigned char pipelined; /* true if operations are not waited on one by one */
+	unsigned char listdone; /* true if sink list was fully received */
+	unsigned char listexpired; /* true if sink list deadline expired */
+	unsigned char meter; /* true if running 'meter' command */
+	unsigned char native; /* true if command can use the native backend */
+	unsigned char link; /* true if running 'link' command */
+	unsigned int timeout[PHNUM]; /* deadline of each phase (msec) */
+	unsigned int ntimedout; /* number of operations that timed out */
+	unsigned int nsinks; /* (streaming) number of sinks received */
+	unsigned int ndone; /* (pipelined) number of sinks command succeeded on */
+	unsigned int nfailed; /* (pipelined) number of sinks command failed on */
+	unsigned int npending; /* (pipelined) number of operations in flight */
+};
+
+
+
 static void sinkinfocb(pa_context* c, const pa_sink_info* si, int eol, void* ud)
 {
-	pavc_State *pavc;
+	PavcCmd *cmd;
 
 	UNUSED(c);
-	UNUSED(eol);
-	pavc = (pavc_State*)ud;
-	if (si) pavc_state_addsinkinfo(pavc, si);
-	pavc_state_signalthreadedml(pavc, 0);
+	cmd = (PavcCmd*)ud;
+	if (si) pavc_state_addsinkinfo(cmd->pavc, si);
+	if (eol < 0) cmd->opok = 0;
+	pavc_state_signalthreadedml(cmd->pavc, 0);
 }
 
 
@@ -46,12 +97,80 @@ static void statechangecb(pa_context* ctx, void* ud)
 
 static void ctxsuccesscb(pa_context *ctx, int success, void* ud)
 {
-	pavc_State *pavc;
+	PavcCmd *cmd;
 
 	UNUSED(ctx);
-	UNUSED(success);
-	pavc = (pavc_State*)ud;
-	pavc_state_signalthreadedml(pavc, 0);
+	cmd = (PavcCmd*)ud;
+	if (cmd->pipelined) {
+		cmd->npending--;
+		if (success) cmd->ndone++;
+		else cmd->nfailed++;
+	} else if (!success) {
+		cmd->opok = 0;
+	}
+	pavc_state_signalthreadedml(cmd->pavc, 0);
+}
+
+
+/* sink info callback that runs the command on each received sink */
+static void streamsinkinfocb(pa_context* c, const pa_sink_info* si, int eol, void* ud)
+{
+	PavcCmd *cmd;
+	unsigned int nissued;
+
+	UNUSED(c);
+	cmd = (PavcCmd*)ud;
+	if (cmd->listexpired) { /* late sink ? */
+		return;
+	} else if (si) {
+		cmd->nsinks++;
+		nissued = cmd->npending + cmd->nfailed;
+		(*cmd->fn)(cmd->pavc, si, cmd);
+		if (cmd->npending + cmd->nfailed == nissued) /* no operation ? */
+			cmd->ndone++;
+	} else {
+		if (eol < 0) cmd->opok = 0;
+		cmd->listdone = 1;
+	}
+	pavc_state_signalthreadedml(cmd->pavc, 0);
+}
+
+
+/*
+ * Wait on current operation, in case it fails while running on cached
+ * sink, the command is only marked as stale, this way caller can retry
+ * it after retrieving up to date sink information. If the phase deadline
+ * expires the operation is cancelled and counted as timed out.
+ * 'opok' is set before the operation is issued, callbacks of the native
+ * backend run (and can report failure) before this is called.
+ * Returns 0 if operation succeeded.
+ */
+static int waitop(pavc_State *pavc, PavcCmd *cmd, const char *errmsg)
+{
+	if (cmd->pipelined) { /* don't wait, 'ctxsuccesscb' tallies the result */
+		if (pavc_state_haveop(pavc)) {
+			cmd->npending++;
+			pavc_state_detachop(pavc);
+		} else {
+			cmd->nfailed++;
+		}
+		return 0;
+	}
+	if (!pavc_state_haveop(pavc))
+		pavc_state_error(pavc, errmsg);
+	if (pavc_state_waitopstate(pavc, PA_OPERATION_DONE) < 0) {
+		pavc_state_removeop(pavc);
+		cmd->ntimedout++;
+		return -1;
+	}
+	pavc_state_removeop(pavc);
+	if (!cmd->opok) {
+		if (!cmd->cached)
+			pavc_state_error(pavc, pavc_state_getoperrormsg(pavc));
+		cmd->stale = 1;
+		return -1;
+	}
+	return 0;
 }
 
 
@@ -64,26 +183,131 @@ static void initeventloop(pavc_State *pavc)
 }
 
 
-static void paconnect(pavc_State *pavc)
+static void paconnect(pavc_State *pavc, PavcCmd *cmd)
 {
+	pavc_state_setdeadline(pavc, cmd->timeout[PHCONNECT]);
 	pavc_state_connect(pavc, statechangecb, pavc, NULL, PA_CONTEXT_NOFLAGS, NULL);
 	pavc_state_waitctxstate(pavc, PA_CONTEXT_READY);
 }
 
 
-static void getsilist(pavc_State *pavc)
+/* connect using the native backend if possible, otherwise libpulse */
+static void serverconnect(pavc_State *pavc, PavcCmd *cmd)
+{
+#if defined(PAVC_NATIVE)
+	if (cmd->native && !cmd->optstream &&
+			pavc_state_connectnative(pavc, "pavc", cmd->timeout[PHCONNECT]) == 0)
+		return;
+#endif
+	initeventloop(pavc);
+	pavc_state_lockthreadedml(pavc); /* get a lock */
+	paconnect(pavc, cmd);
+}
+
+
+static void getsilist(pavc_State *pavc, PavcCmd *cmd)
 {
-	const char *err;
+	cmd->opok = 1;
+	pavc_state_getsinkinfolist(pavc, sinkinfocb, cmd);
+	if (waitop(pavc, cmd, "couldn't retrieve sink list") == 0)
+		pavc_cache_rebuild(pavc); /* only a complete list */
+}
 
-	pavc_state_getsinkinfolist(pavc, sinkinfocb, pavc);
-	if (pavc_state_haveop(pavc)) {
-		pavc_state_waitopstate(pavc, PA_OPERATION_DONE);
-		if ((err = pavc_state_checkerror(pavc)))
-			pavc_state_error(pavc, err);
-		pavc_state_removeop(pavc);
-	} else {
+
+/*
+ * Run the command from the sink info callback as each sink arrives, sinks
+ * are not stored and operations are not waited on one by one.
+ */
+static void streamsilist(pavc_State *pavc, PavcCmd *cmd)
+{
+	pa_operation *listop;
+
+	cmd->pipelined = 1;
+	cmd->opok = 1;
+	pavc_state_getsinkinfolist(pavc, streamsinkinfocb, cmd);
+	if (!pavc_state_haveop(pavc))
 		pavc_state_error(pavc, "couldn't retrieve sink list");
+	listop = pavc_state_takeop(pavc); /* operations issued from the callback replace it */
+	while (!cmd->listdone) {
+		if (!pavc_state_connected(pavc))
+			pavc_state_error(pavc, "connection to the server was lost");
+		if (pa_operation_get_state(listop) == PA_OPERATION_CANCELLED)
+			pavc_state_error(pavc, "operation failed");
+		if (pavc_state_expired(pavc)) { /* stop at sinks received so far */
+			pa_operation_cancel(listop);
+			cmd->listexpired = 1;
+			cmd->ntimedout++;
+			break;
+		}
+		pavc_state_waitthreadedml(pavc);
+	}
+	pa_operation_unref(listop);
+	pavc_state_setdeadline(pavc, cmd->timeout[PHOP]);
+	while (cmd->npending > 0 && !pavc_state_expired(pavc)) {
+		if (!pavc_state_connected(pavc))
+			pavc_state_error(pavc, "connection to the server was lost");
+		pavc_state_waitthreadedml(pavc);
+	}
+	pavc_state_freedetached(pavc); /* cancel the ones still running */
+	cmd->ntimedout += cmd->npending;
+	if (cmd->nfailed > 0 || cmd->npending > 0) /* cached states unknown */
+		pavc_cache_invalidate(pavc);
+	fprintf(stderr, "pavc: %u sinks, %u done, %u failed, %u timed out.\n",
+			cmd->nsinks, cmd->ndone, cmd->nfailed, cmd->ntimedout);
+	if (!cmd->opok)
+		pavc_state_error(pavc, pavc_state_getoperrormsg(pavc));
+	if (cmd->nfailed > 0)
+		pavc_state_error(pavc, "command failed on some sinks");
+}
+
+
+/*
+ * Compute the new volume of every sink in one pass of the volume kernel,
+ * then send all of them without waiting on each operation.
+ */
+static void runbatch(pavc_State *pavc, PavcCmd *cmd)
+{
+	const pa_sink_info *si;
+	pavc_Volbatch *b;
+	pa_cvolume cv;
+	unsigned int nsi, i, j, n;
+
+	nsi = pavc_state_getsinkcount(pavc);
+	for (n = i = 0; i < nsi; i++)
+		n += pavc_state_getsinkinfo(pavc, i)->volume.channels;
+	b = pavc_volume_newbatch(pavc, n);
+	for (n = i = 0; i < nsi; i++) {
+		si = pavc_state_getsinkinfo(pavc, i);
+		for (j = 0; j < si->volume.channels; j++)
+			b->v[n + j] = si->volume.values[j];
+		(*cmd->plan)(si, cmd, &b->mul[n], &b->add[n]);
+		n += si->volume.channels;
+	}
+	pavc_volume_apply(b->v, b->mul, b->add, b->n, (float)PA_VOLUME_MAX);
+	cmd->pipelined = 1;
+	for (n = i = 0; i < nsi; i++) {
+		si = pavc_state_getsinkinfo(pavc, i);
+		cv.channels = si->volume.channels;
+		pavc_volume_tocvolume(&b->v[n], &cv);
+		n += cv.channels;
+		if (pa_cvolume_equal(&cv, &si->volume)) /* nothing to change ? */
+			continue;
+		pavc_state_setsinkvolumeindex(pavc, si, &cv, ctxsuccesscb, cmd);
+		waitop(pavc, cmd, "failed setting sink volume");
+		pavc_cache_setvolume(pavc, si->index, &cv);
 	}
+	pavc_volume_freebatch(pavc);
+	while (cmd->npending > 0 && !pavc_state_expired(pavc)) {
+		if (!pavc_state_connected(pavc))
+			pavc_state_error(pavc, "connection to the server was lost");
+		pavc_state_waitthreadedml(pavc);
+	}
+	pavc_state_freedetached(pavc); /* cancel the ones still running */
+	cmd->ntimedout += cmd->npending;
+	if (cmd->nfailed > 0 || cmd->npending > 0) /* cached volumes unknown */
+		pavc_cache_invalidate(pavc);
+	if (cmd->nfailed > 0)
+		pavc_state_error(pavc, "command failed on some sinks");
 }
 
 
@@ -103,35 +327,43 @@ static p_noret usagePavc(pavc_State *pavc)
 {
 	fputs(
 	"\nSynopsis:\n"
-	"pavc [command    [value]    [sink device name]]\n"
+	"pavc [-s] [-t msec[,msec[,msec]]] [command    [value]    [sink device name]]\n"
 	"      toggle     N/A\n"
 	"      up         0..100 (%)\n"
 	"      down       0..100 (%)\n"
 	"      volume     percent | decibel\n"
+	"      meter      N/A\n"
+	"      set        position=0..100[,position=0..100...] (%)\n"
+	"      balance    -100..100 (left..right)\n"
+	"      link       sink,sink[,sink...] ...\n"
+	"pavc --complete [word...]\n"
 	"\nExamples:\n"
 	" - pavc toggle (toggles mute on all sink devices)\n"
 	" - pavc up 5 (increases volume by 5% on all sink devices)\n"
 	" - pavc down 10 (decreases volume by 10%, on all sink devices)\n"
 	" - pavc volume percent (returns the current volume level of all devices as percentage)\n"
-	" - pavc volume decibel (returns the current volume level of all devices in decibels)\n\n",
+	" - pavc volume decibel (returns the current volume level of all devices in decibels)\n"
+	" - pavc meter (prints peak level of each channel of all devices)\n"
+	" - pavc set front-left=40,front-right=60 (sets level of those channels on all devices)\n"
+	" - pavc balance -20 (moves balance of all devices 20% to the left)\n"
+	" - pavc link a,b (keeps volume and mute of sinks a and b the same)\n"
+	"\nOptions:\n"
+	" -s  stream, run the command on each sink as soon as it is received\n"
+	" -t  deadlines for connecting, listing sinks and sink operations\n"
+	"     (0 means no deadline, exit status is 2 if one expires)\n"
+	" --complete  print completions for the last word (used by shell completion)\n\n",
 	stderr);
 	pavc_state_error(pavc, "usage error"); /* this flushes stderr */
 }
 
 
-static void changevolume(pavc_State *pavc, const pa_sink_info *si, pa_cvolume *cvnew)
+static void changevolume(pavc_State *pavc, const pa_sink_info *si, pa_cvolume *cvnew,
+				PavcCmd *cmd)
 {
-	const char *err;
-
-	pavc_state_setsinkvolumeindex(pavc, si, cvnew, ctxsuccesscb, pavc);
-	if (pavc_state_haveop(pavc)) {
-		pavc_state_waitopstate(pavc, PA_OPERATION_DONE);
-		if ((err = pavc_state_checkerror(pavc)))
-			pavc_state_error(pavc, err);
-		pavc_state_removeop(pavc);
-	} else {
-		pavc_state_error(pavc, "failed setting sink volume");
-	}
+	cmd->opok = 1;
+	pavc_state_setsinkvolumeindex(pavc, si, cvnew, ctxsuccesscb, cmd);
+	if (waitop(pavc, cmd, "failed setting sink volume") == 0)
+		pavc_cache_setvolume(pavc, si->index, cvnew);
 }
 
 
@@ -141,73 +373,52 @@ static void changevolume(pavc_State *pavc, const pa_sink_info *si, pa_cvolume *c
  * ------------------------------------------------------------------------- */
 
 
-typedef void (*Cmdfunction)(pavc_State *pavc, const pa_sink_info *si, void *ud);
-
-
-typedef struct PavcCmd {
-	Cmdfunction fn;
-	union {
-		unsigned int n;
-		const char *str;
-	} val;
-	const char *sinkname;
-} PavcCmd;
-
-
 #define scaleVOL(n)	(PA_VOLUME_NORM * ((n) / 100.0))
 
 
-static void cmddown(pavc_State *pavc, const pa_sink_info *si, void *ud)
+static void cmddown(pavc_State *pavc, const pa_sink_info *si, PavcCmd *cmd)
 {
 	pa_cvolume cvnew;
 	pa_volume_t dec;
 
 	cvnew = si->volume;
-	dec = scaleVOL(*(unsigned int *)ud);
+	dec = scaleVOL(cmd->val.n);
 	if(pa_cvolume_dec(&cvnew, dec))
-		changevolume(pavc, si, &cvnew);
+		changevolume(pavc, si, &cvnew, cmd);
 	else
 		pavc_state_error(pavc, "failed decrementing volume");
 }
 
 
-static void cmdup(pavc_State *pavc, const pa_sink_info *si, void *ud)
+static void cmdup(pavc_State *pavc, const pa_sink_info *si, PavcCmd *cmd)
 {
         pa_cvolume cvnew;
         pa_volume_t inc;
 
 	cvnew = si->volume;
-	inc = scaleVOL(*(unsigned int *)ud);
+	inc = scaleVOL(cmd->val.n);
 	if(pa_cvolume_inc_clamp(&cvnew, inc, PA_VOLUME_NORM))
-		changevolume(pavc, si, &cvnew);
+		changevolume(pavc, si, &cvnew, cmd);
 	else
 		pavc_state_error(pavc, "failed incrementing volume");
 }
 
 
-static void cmdtoggle(pavc_State *pavc, const pa_sink_info *si, void *ud)
+static void cmdtoggle(pavc_State *pavc, const pa_sink_info *si, PavcCmd *cmd)
 {
-	const char *err;
-
-	UNUSED(ud);
-	pavc_state_setsinkmuteindex(pavc, si, si->mute^1, ctxsuccesscb, pavc);
-	if (pavc_state_haveop(pavc)) {
-		pavc_state_waitopstate(pavc, PA_OPERATION_DONE);
-		if ((err = pavc_state_checkerror(pavc)))
-			pavc_state_error(pavc, err);
-		pavc_state_removeop(pavc);
-	} else {
-		pavc_state_error(pavc, "failed to toggle mute");
-	}
+	cmd->opok = 1;
+	pavc_state_setsinkmuteindex(pavc, si, si->mute^1, ctxsuccesscb, cmd);
+	if (waitop(pavc, cmd, "failed to toggle mute") == 0)
+		pavc_cache_setmute(pavc, si->index, si->mute^1);
 }
 
 
-static void cmdvolume(pavc_State *pavc, const pa_sink_info* si, void *ud)
+static void cmdvolume(pavc_State *pavc, const pa_sink_info* si, PavcCmd *cmd)
 {
 	const char *unit;
 	pa_volume_t avg;
 
-	unit = *(const char **)ud;
+	unit = cmd->val.str;
 	avg = pa_cvolume_avg(&si->volume);
 	if(!strcmp(unit, "percent")) {
 		avg = ((double)avg / (double)PA_VOLUME_NORM) * 100.0;
@@ -220,6 +431,84 @@ static void cmdvolume(pavc_State *pavc, const pa_sink_info* si, void *ud)
 }
 
 
+static void cmdmeter(pavc_State *pavc, const pa_sink_info *si, PavcCmd *cmd)
+{
+	UNUSED(cmd);
+	pavc_meter_new(pavc, si);
+}
+
+
+/* 'set' level on positions of 'si' channel map, other channels are kept */
+static void planset(const pa_sink_info *si, PavcCmd *cmd, float *mul, float *add)
+{
+	pa_channel_position_t pos;
+	unsigned int j;
+
+	for (j = 0; j < si->volume.channels; j++) {
+		pos = (j < si->channel_map.channels ? si->channel_map.map[j]
+						    : PA_CHANNEL_POSITION_INVALID);
+		if (pos >= 0 && pos < PA_CHANNEL_POSITION_MAX && cmd->haslevel[pos]) {
+			mul[j] = 0.0f;
+			add[j] = cmd->level[pos];
+		} else {
+			mul[j] = 1.0f;
+			add[j] = 0.0f;
+		}
+	}
+}
+
+
+/*
+ * Louder of the two sides (average of its channels) keeps its volume, the
+ * other one is attenuated by the balance, same as 'pa_cvolume_set_balance';
+ * channels on each side are scaled together, the rest are kept.
+ */
+static void planbalance(const pa_sink_info *si, PavcCmd *cmd, float *mul, float *add)
+{
+	pa_channel_position_t pos;
+	float left, right, side, b, lnew, rnew, vnew;
+	unsigned int j, nleft, nright;
+
+	left = right = 0.0f;
+	nleft = nright = 0;
+	for (j = 0; j < si->channel_map.channels && j < si->volume.channels; j++) {
+		pos = si->channel_map.map[j];
+		if (pa_channel_position_is_left(pos)) {
+			left += si->volume.values[j];
+			nleft++;
+		} else if (pa_channel_position_is_right(pos)) {
+			right += si->volume.values[j];
+			nright++;
+		}
+	}
+	left = (nleft ? left / nleft : 0.0f);
+	right = (nright ? right / nright : 0.0f);
+	b = cmd->val.i / 100.0f;
+	vnew = (left > right ? left : right);
+	lnew = (b > 0.0f ? vnew * (1.0f - b) : vnew);
+	rnew = (b < 0.0f ? vnew * (1.0f + b) : vnew);
+	for (j = 0; j < si->volume.channels; j++) {
+		pos = (j < si->channel_map.channels ? si->channel_map.map[j]
+						    : PA_CHANNEL_POSITION_INVALID);
+		mul[j] = 1.0f;
+		add[j] = 0.0f;
+		if (pa_channel_position_is_left(pos)) {
+			side = left;
+			vnew = lnew;
+		} else if (pa_channel_position_is_right(pos)) {
+			side = right;
+			vnew = rnew;
+		} else {
+			continue;
+		}
+		if (side > 0.0f)
+			mul[j] = vnew / side;
+		else
+			mul[j] = 0.0f, add[j] = vnew;
+	}
+}
+
+
 static int strtovolume(const char *str, unsigned int *vol)
 {
         int c;
@@ -246,6 +535,8 @@ static void parsetoggle(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
 	if (argc == 1)
 		cmd->sinkname = *argv;
 	cmd->fn = &cmdtoggle;
+	cmd->cacheable = 1;
+	cmd->native = 1;
 }
 
 
@@ -260,6 +551,8 @@ static void parseupdown(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
 	if (argc == 2)
 		cmd->sinkname = argv[1];
 	cmd->fn = (*argv[-1] == 'u' ? &cmdup : &cmddown);
+	cmd->cacheable = 1;
+	cmd->native = 1;
 }
 
 
@@ -269,30 +562,357 @@ static void parsevolume(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
 		pavc_state_error(pavc, "too many arguments provided for 'volume' command");
 	if (argc == 0)
 		pavc_state_error(pavc, "missing unit specifier for 'volume' command");
+	if (strcmp(*argv, "percent") && strcmp(*argv, "decibel"))
+		pavc_state_error(pavc, "invalid unit for 'volume' (try decibel or percent)");
 	cmd->val.str = *argv;
 	if (argc == 2)
 		cmd->sinkname = argv[1];
 	cmd->fn = &cmdvolume;
+	cmd->native = 1;
+}
+
+
+static void parsemeter(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
+{
+	if (argc > 1)
+		pavc_state_error(pavc, "too many arguments provided for 'meter' command");
+	if (argc == 1)
+		cmd->sinkname = *argv;
+	cmd->fn = &cmdmeter;
+	cmd->meter = 1;
+}
+
+
+/* 'position=level[,position=level...]', position 'all' means every channel */
+static void parseset(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
+{
+	pa_channel_position_t pos;
+	char *spec, *lvl, *end, *lvlend;
+	unsigned long vol;
+	int i;
+
+	if (argc <= 0)
+		pavc_state_error(pavc, "set command is missing channel levels");
+	if (argc > 2) /* levels + optional name of sink device */
+		pavc_state_error(pavc, "too many arguments provided for 'set' command");
+	for (spec = *argv; spec; spec = end) {
+		if ((end = strchr(spec, ',')))
+			*end++ = '\0';
+		if ((lvl = strchr(spec, '=')) == NULL)
+			pavc_state_error(pavc, "invalid channel level (try position=level)");
+		*lvl++ = '\0';
+		if (!isdigit((unsigned char)*lvl))
+			pavc_state_error(pavc, "invalid volume value");
+		vol = strtoul(lvl, &lvlend, 10);
+		if (*lvlend != '\0' || vol > 100) /* levels are not clamped */
+			pavc_state_error(pavc, "invalid volume value");
+		if (!strcmp(spec, "all")) {
+			for (i = 0; i < PA_CHANNEL_POSITION_MAX; i++) {
+				cmd->level[i] = scaleVOL(vol);
+				cmd->haslevel[i] = 1;
+			}
+		} else {
+			pos = pa_channel_position_from_string(spec);
+			if (pos < 0 || pos >= PA_CHANNEL_POSITION_MAX)
+				pavc_state_error(pavc, "invalid channel position");
+			cmd->level[pos] = scaleVOL(vol);
+			cmd->haslevel[pos] = 1;
+		}
+	}
+	if (argc == 2)
+		cmd->sinkname = argv[1];
+	cmd->plan = &planset;
+}
+
+
+static void parsebalance(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
+{
+	char *end;
+	long bal;
+
+	if (argc <= 0)
+		pavc_state_error(pavc, "balance command is missing balance value");
+	if (argc > 2) /* balance + optional name of sink device */
+		pavc_state_error(pavc, "too many arguments provided for 'balance' command");
+	bal = strtol(*argv, &end, 10);
+	if (end == *argv || *end != '\0' || bal < -100 || bal > 100)
+		pavc_state_error(pavc, "invalid balance value (try -100..100)");
+	cmd->val.i = (int)bal;
+	if (argc == 2)
+		cmd->sinkname = argv[1];
+	cmd->plan = &planbalance;
+}
+
+
+/* each argument is a group, 'sink,sink[,sink...]' */
+static void parselink(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
+{
+	unsigned int group, n;
+	char *name, *end;
+
+	if (argc <= 0)
+		pavc_state_error(pavc, "missing sink groups for 'link' command");
+	for (; argc > 0; argc--, argv++) {
+		group = pavc_link_newgroup(pavc);
+		n = 0;
+		for (name = *argv; name; name = end) {
+			if ((end = strchr(name, ',')))
+				*end++ = '\0';
+			if (*name == '\0')
+				pavc_state_error(pavc, "empty sink name in link group");
+			pavc_link_add(pavc, group, name);
+			n++;
+		}
+		if (n < 2)
+			pavc_state_error(pavc, "link group needs at least two sinks");
+	}
+	cmd->link = 1;
+}
+
+
+/* '-t msec[,msec[,msec]]', missing deadlines repeat the last one */
+static void parsetimeout(pavc_State *pavc, PavcCmd *cmd, const char *str)
+{
+	unsigned long msec;
+	char *end;
+	int i;
+
+	msec = 0;
+	for (i = 0; i < PHNUM; i++) {
+		if (*str) {
+			if (!isdigit((unsigned char)*str))
+				pavc_state_error(pavc, "invalid deadline value");
+			msec = strtoul(str, &end, 10);
+			if (msec > UINT_MAX || (*end != ',' && *end != '\0'))
+				pavc_state_error(pavc, "invalid deadline value");
+			str = end + (*end == ',');
+		}
+		cmd->timeout[i] = msec;
+	}
+	if (*str)
+		pavc_state_error(pavc, "too many deadline values");
+}
+
+
+typedef void (*Parsefunction)(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv);
+
+
+static const char *const volumeunits[] = { "percent", "decibel", NULL };
+
+
+static const struct {
+	const char *name;
+	Parsefunction parse;
+	unsigned int nvals; /* number of values before sink device name */
+	const char *const *vals; /* possible values, NULL if any */
+	unsigned char sinklists; /* true if each argument is 'sink,sink...' */
+} commands[] = {
+	{ "toggle", parsetoggle, 0, NULL, 0 },
+	{ "up", parseupdown, 1, NULL, 0 },
+	{ "down", parseupdown, 1, NULL, 0 },
+	{ "volume", parsevolume, 1, volumeunits, 0 },
+	{ "meter", parsemeter, 0, NULL, 0 },
+	{ "set", parseset, 1, NULL, 0 },
+	{ "balance", parsebalance, 1, NULL, 0 },
+	{ "link", parselink, 0, NULL, 1 },
+};
+
+
+static int findcommand(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < sizeof(commands)/sizeof(commands[0]); i++)
+		if (!strcmp(commands[i].name, name))
+			return i;
+	return -1;
+}
+
+
+static void setdefaulttimeouts(PavcCmd *cmd)
+{
+	cmd->timeout[PHCONNECT] = PAVC_CONNECTTIMEOUT;
+	cmd->timeout[PHLIST] = PAVC_LISTTIMEOUT;
+	cmd->timeout[PHOP] = PAVC_OPTIMEOUT;
 }
 
 
 static void parseargs(pavc_State *pavc, PavcCmd *cmd, int argc, char** argv)
 {
         const char* argcmd;
-
-        if (argc <= 1) usagePavc(pavc);
-	argcmd = argv[1]; /* skip command */
-	argv += 2;
-	argc -= 2;
-	if (!strcmp(argcmd, "toggle")) {
-		parsetoggle(pavc, cmd, argc, argv);
-	} else if (!strcmp(argcmd, "up") || !strcmp(argcmd, "down")) {
-		parseupdown(pavc, cmd, argc, argv);
-	} else if (!strcmp(argcmd, "volume")) {
-		parsevolume(pavc, cmd, argc, argv);
-	} else {
+	int i;
+
+	argv++; /* skip program name */
+	argc--;
+	setdefaulttimeouts(cmd);
+	for (; argc > 0 && **argv == '-'; argv++, argc--) { /* options */
+		if (!strcmp(*argv, "-s")) {
+			cmd->optstream = 1;
+		} else if (!strcmp(*argv, "-t")) {
+			if (argc < 2)
+				pavc_state_error(pavc, "missing deadline value for '-t'");
+			parsetimeout(pavc, cmd, *++argv);
+			argc--;
+		} else {
+			pavc_state_error(pavc, "invalid option");
+		}
+	}
+        if (argc <= 0) usagePavc(pavc);
+	argcmd = argv[0]; /* skip command */
+	argv++;
+	argc--;
+	if ((i = findcommand(argcmd)) < 0)
 		pavc_state_error(pavc, "invalid command");
+	(*commands[i].parse)(pavc, cmd, argc, argv);
+}
+
+
+
+/* -------------------------------------------------------------------------
+ * Shell completion
+ * ------------------------------------------------------------------------- */
+
+
+static void printmatch(const char *str, const char *prefix)
+{
+	if (!strncmp(str, prefix, strlen(prefix)))
+		puts(str);
+}
+
+
+/* print cached sink names, in a sink list only the name after the last
+ * comma is completed (the rest of 'word' is kept) */
+static void printsinks(pavc_State *pavc, const char *word, int list)
+{
+	const char *name;
+	unsigned int i;
+	int n;
+
+	n = 0;
+	if (list && (name = strrchr(word, ',')))
+		n = name - word + 1;
+	for (i = 0; i < pavc_cache_getsinkcount(pavc); i++) {
+		name = pavc_cache_getsink(pavc, i)->name;
+		if (!strncmp(name, word + n, strlen(word + n)))
+			printf("%.*s%s\n", n, word, name);
+	}
+}
+
+
+/*
+ * Retrieve the sink list in a detached child and store it in the cache,
+ * completion itself only ever reads the cache. Only one child refreshes
+ * at a time, the lock is considered stale once the child would have hit
+ * its deadlines.
+ */
+static void refreshcache(pavc_State *pavc, PavcCmd *cmd)
+{
+	long maxage;
+	pid_t pid;
+	int fd;
+
+	if (!pavc_cache_needlist(pavc))
+		return;
+	maxage = (cmd->timeout[PHCONNECT] + (long)cmd->timeout[PHLIST]) / 1000 + 1;
+	if (pavc_cache_lock(pavc, maxage) < 0) /* already being refreshed ? */
+		return;
+	fflush(stdout);
+	if ((pid = fork()) < 0)
+		pavc_cache_unlock(pavc);
+	if (pid != 0) /* parent (or fork failed) ? */
+		return;
+	setsid();
+	if ((fd = open("/dev/null", O_RDWR)) >= 0) { /* don't hold the shell's pipe */
+		dup2(fd, STDIN_FILENO);
+		dup2(fd, STDOUT_FILENO);
+		dup2(fd, STDERR_FILENO);
+		if (fd > STDERR_FILENO)
+			close(fd);
+	}
+	cmd->native = 1;
+	serverconnect(pavc, cmd);
+	pavc_state_setdeadline(pavc, cmd->timeout[PHLIST]);
+	getsilist(pavc, cmd);
+	pavc_cache_save(pavc);
+	pavc_cache_unlock(pavc);
+	pavc_state_delete(pavc);
+	exit(EXIT_SUCCESS);
+}
+
+
+/*
+ * 'pavc --complete word...', 'word's are the command line words after
+ * program name, the last one being the word under completion. Prints
+ * matching options, commands, values or cached sink names one per line.
+ */
+static void complete(pavc_State *pavc, PavcCmd *cmd, int argc, char **argv)
+{
+	const char *const *vals;
+	const char *word;
+	unsigned int i, n, pos;
+	int c;
+
+	word = (argc > 0 ? argv[argc - 1] : "");
+	n = (argc > 0 ? argc - 1 : 0); /* completed words */
+	setdefaulttimeouts(cmd);
+	for (i = 0; i < n && *argv[i] == '-'; i++) /* options */
+		i += !strcmp(argv[i], "-t"); /* skip deadline value */
+	if (i > n) { /* deadline value */
+		return;
+	} else if (i == n) { /* command */
+		if (*word == '-') {
+			printmatch("-s", word);
+			printmatch("-t", word);
+		} else {
+			for (c = 0; c < (int)(sizeof(commands)/sizeof(commands[0])); c++)
+				printmatch(commands[c].name, word);
+		}
+		return;
 	}
+	if ((c = findcommand(argv[i])) < 0)
+		return;
+	pos = n - i - 1;
+	if (pos < commands[c].nvals) {
+		for (vals = commands[c].vals; vals && *vals; vals++)
+			printmatch(*vals, word);
+	} else if (pos == commands[c].nvals || commands[c].sinklists) {
+		pavc_cache_init(pavc);
+		printsinks(pavc, word, commands[c].sinklists);
+		refreshcache(pavc, cmd);
+	}
+}
+
+
+
+/*
+ * Run the command on cached sink, this skips retrieving sink information
+ * from the server. Returns 0 if cached sink can't be used or it turned out
+ * to be stale.
+ */
+static int runcached(pavc_State *pavc, PavcCmd *cmd)
+{
+	const pavc_Cachesink *cs;
+	pa_sink_info si;
+
+	if (!cmd->cacheable || (cs = pavc_cache_find(pavc, cmd->sinkname)) == NULL ||
+			!pavc_cache_fresh(pavc, cs))
+		return 0;
+	memset(&si, 0, sizeof(si));
+	si.name = cs->name;
+	si.index = cs->index;
+	si.channel_map = cs->map;
+	si.volume = cs->volume;
+	si.mute = cs->mute;
+	pavc_state_setdeadline(pavc, cmd->timeout[PHOP]);
+	cmd->cached = 1;
+	(*cmd->fn)(pavc, &si, cmd);
+	cmd->cached = 0;
+	if (cmd->stale) {
+		pavc_cache_invalidate(pavc);
+		cmd->stale = 0;
+		return 0;
+	}
+	return 1;
 }
 
 
@@ -301,30 +921,89 @@ static void runthecommand(pavc_State *pavc, PavcCmd *cmd)
 	unsigned int nsi;
 	unsigned int i;
 	const pa_sink_info *si;
-	const char *err;
 
 	if (cmd->sinkname) { /* only for specific sink device ? */
-		pavc_state_getsinkinfoname(pavc, cmd->sinkname, sinkinfocb, pavc);
-		if (pavc_state_haveop(pavc)) {
-			pavc_state_waitopstate(pavc, PA_OPERATION_DONE);
-			if ((err = pavc_state_checkerror(pavc)))
-				pavc_state_error(pavc, err);
-			pavc_state_removeop(pavc);
-			(*cmd->fn)(pavc, pavc_state_getlastsinkinfo(pavc), &cmd->val);
-		} else {
-			pavc_state_error(pavc, "failed to retrieve sink information");
-		}
+		if (runcached(pavc, cmd))
+			return;
+		pavc_state_setdeadline(pavc, cmd->timeout[PHLIST]);
+		cmd->opok = 1;
+		pavc_state_getsinkinfoname(pavc, cmd->sinkname, sinkinfocb, cmd);
+		if (waitop(pavc, cmd, "failed to retrieve sink information") < 0)
+			pavc_state_timeout(pavc, "timed out retrieving sink information");
+		if ((si = pavc_state_getlastsinkinfo(pavc)) == NULL)
+			pavc_state_error(pavc, "no such sink device");
+		pavc_cache_setsink(pavc, si);
+		pavc_state_setdeadline(pavc, cmd->timeout[PHOP]);
+		if (cmd->plan)
+			runbatch(pavc, cmd);
+		else
+			(*cmd->fn)(pavc, si, cmd);
+	} else if (cmd->optstream && !cmd->plan) { /* run on all sink devices as they arrive */
+		pavc_state_setdeadline(pavc, cmd->timeout[PHLIST]);
+		streamsilist(pavc, cmd);
 	} else { /* run on all sink devices */
-		getsilist(pavc);
+		pavc_state_setdeadline(pavc, cmd->timeout[PHLIST]);
+		getsilist(pavc, cmd); /* on timeout only sinks received so far */
+		pavc_state_setdeadline(pavc, cmd->timeout[PHOP]);
+		if (cmd->plan) { /* all sinks in one batch */
+			runbatch(pavc, cmd);
+			return;
+		}
 		nsi = pavc_state_getsinkcount(pavc);
 		for (i = 0; i < nsi; i++) {
+			if (pavc_state_expired(pavc)) { /* skip the rest */
+				cmd->ntimedout += nsi - i;
+				break;
+			}
 			si = pavc_state_getsinkinfo(pavc, i);
-			(*cmd->fn)(pavc, si, &cmd->val);
+			(*cmd->fn)(pavc, si, cmd);
 		}
 	}
 }
 
 
+/*
+ * Keep linked sinks in sync until killed. Sink events are left to
+ * accumulate for 'PAVC_LINKDEBOUNCE' msec, then changed sinks are
+ * retrieved and their groups updated, each step as a single batch.
+ * A step that misses its deadline is retried with the whole sink list,
+ * only losing the connection ends the loop.
+ */
+static p_noret runlinks(pavc_State *pavc, PavcCmd *cmd)
+{
+	pavc_state_setdeadline(pavc, cmd->timeout[PHOP]);
+	pavc_link_subscribe(pavc);
+	for (;;) {
+		pavc_state_cleardeadline(pavc);
+		while (!pavc_link_pending(pavc)) {
+			if (!pavc_state_connected(pavc))
+				pavc_state_error(pavc, "connection to the server was lost");
+			pavc_state_waitthreadedml(pavc);
+		}
+		pavc_state_setdeadline(pavc, PAVC_LINKDEBOUNCE);
+		while (!pavc_state_expired(pavc))
+			pavc_state_waitthreadedml(pavc);
+		pavc_state_setdeadline(pavc, cmd->timeout[PHLIST]);
+		if (pavc_link_refresh(pavc) < 0)
+			continue;
+		pavc_state_setdeadline(pavc, cmd->timeout[PHOP]);
+		pavc_link_propagate(pavc);
+	}
+}
+
+
+/* print sink levels until all metered sinks are gone */
+static void runmeters(pavc_State *pavc)
+{
+	do {
+		pavc_state_setdeadline(pavc, 1000 / PAVC_METERHZ);
+		while (!pavc_state_expired(pavc))
+			pavc_state_waitthreadedml(pavc);
+	} while (pavc_meter_print(pavc, stdout) > 0);
+	pavc_state_error(pavc, "no sink left to meter");
+}
+
+
 static void newstate(pavc_State **pavcp)
 {
 	if (p_unlikely((*pavcp = pavc_state_new(pavc_alloc, NULL)) == NULL)) {
@@ -340,11 +1019,23 @@ int main(int argc, char** argv)
 	PavcCmd cmd = { 0 };
 
 	newstate(&pavc);
+	cmd.pavc = pavc;
+	if (argc > 1 && !strcmp(argv[1], "--complete")) {
+		complete(pavc, &cmd, argc - 2, argv + 2);
+		pavc_state_delete(pavc);
+		return 0;
+	}
 	parseargs(pavc, &cmd, argc, argv);
-	initeventloop(pavc);
-	pavc_state_lockthreadedml(pavc); /* get a lock */
-	paconnect(pavc);
+	pavc_cache_init(pavc);
+	serverconnect(pavc, &cmd);
+	if (cmd.link)
+		runlinks(pavc, &cmd);
 	runthecommand(pavc, &cmd);
+	pavc_cache_save(pavc);
+	if (cmd.ntimedout > 0)
+		pavc_state_timeout(pavc, "deadline expired, results are partial");
+	if (cmd.meter)
+		runmeters(pavc);
 	pavc_state_delete(pavc);
 	return 0;
 }
@@ -0,0 +1,420 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "pcache.h"
+#include "pstate.h"
+#include "pmem.h"
+
+
+/* cache file format version */
+#define CACHEVERSION	3
+
+/* maximum length of a line in cache file */
+#define MAXLINE		2048
+
+
+#define getcache(pavc)		(&(pavc)->cache)
+
+
+
+/*
+ * Server identity is taken from the native protocol socket, it gets
+ * recreated each time the server starts. Custom servers ('PULSE_SERVER')
+ * are not cached as they can't be identified without connecting.
+ */
+static int getserverid(pavc_Serverid *id)
+{
+	char path[PAVC_MAXPATH];
+	struct stat st;
+
+	if (pavc_native_socketpath(path, sizeof(path)) < 0 || stat(path, &st) < 0)
+		return -1;
+	id->dev = st.st_dev;
+	id->ino = st.st_ino;
+	id->mtime = st.st_mtime;
+	return 0;
+}
+
+
+static int sameserver(const pavc_Serverid *a, const pavc_Serverid *b)
+{
+	return (a->dev == b->dev && a->ino == b->ino && a->mtime == b->mtime);
+}
+
+
+static void freeentries(pavc_State *pavc)
+{
+	pavc_Cache *c;
+	unsigned int i;
+
+	c = getcache(pavc);
+	for (i = 0; i < c->nsinks; i++)
+		pavc_mem_free(pavc, c->sinks[i].name, strlen(c->sinks[i].name) + 1);
+	c->nsinks = 0;
+}
+
+
+static pavc_Cachesink *newentry(pavc_State *pavc, const char *name)
+{
+	pavc_Cache *c;
+	pavc_Cachesink *cs;
+
+	c = getcache(pavc);
+	pavc_mem_growarray(pavc, c->sinks, &c->sizesinks, c->nsinks, UINT_MAX,
+				pavc_Cachesink);
+	cs = &c->sinks[c->nsinks++];
+	cs->name = pavc_mem_strdup(pavc, name);
+	return cs;
+}
+
+
+static pavc_Cachesink *findentry(pavc_Cache *c, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->nsinks; i++)
+		if (!strcmp(c->sinks[i].name, name))
+			return &c->sinks[i];
+	return NULL;
+}
+
+
+static pavc_Cachesink *findentryindex(pavc_Cache *c, uint32_t index)
+{
+	unsigned int i;
+
+	for (i = 0; i < c->nsinks; i++)
+		if (c->sinks[i].index == index)
+			return &c->sinks[i];
+	return NULL;
+}
+
+
+static int readnum(char **s, unsigned long *n)
+{
+	char *end;
+
+	*n = strtoul(*s, &end, 10);
+	if (end == *s || *end != ' ')
+		return -1;
+	*s = end + 1;
+	return 0;
+}
+
+
+/* 'sink <index> <mute> <stamp> <channels> <volume>... <position>... <name>' */
+static int readsink(pavc_State *pavc, char *line)
+{
+	pavc_Cachesink *cs;
+	pa_cvolume cv;
+	pa_channel_map map;
+	unsigned long index, mute, stamp, n, i, x;
+	char *nl;
+
+	if (strncmp(line, "sink ", 5) != 0)
+		return -1;
+	line += 5;
+	if (readnum(&line, &index) < 0 || readnum(&line, &mute) < 0 ||
+			readnum(&line, &stamp) < 0 || readnum(&line, &n) < 0 || n == 0 || n > PA_CHANNELS_MAX)
+		return -1;
+	cv.channels = map.channels = n;
+	for (i = 0; i < n; i++) {
+		if (readnum(&line, &x) < 0) return -1;
+		cv.values[i] = x;
+	}
+	for (i = 0; i < n; i++) {
+		if (readnum(&line, &x) < 0 || x >= PA_CHANNEL_POSITION_MAX)
+			return -1;
+		map.map[i] = (pa_channel_position_t)x;
+	}
+	if ((nl = strchr(line, '\n')) == NULL || nl == line)
+		return -1; /* truncated line or missing name */
+	*nl = '\0';
+	cs = newentry(pavc, line);
+	cs->index = index;
+	cs->mute = (mute != 0);
+	cs->volume = cv;
+	cs->map = map;
+	cs->stamp = (long)stamp;
+	return 0;
+}
+
+
+static void load(pavc_State *pavc, FILE *fp)
+{
+	pavc_Cache *c;
+	pavc_Serverid id;
+	char line[MAXLINE];
+	unsigned int version;
+	long liststamp;
+
+	c = getcache(pavc);
+	if (fgets(line, sizeof(line), fp) == NULL ||
+			sscanf(line, "pavc %u %lu %lu %ld %ld", &version, &id.dev,
+				&id.ino, &id.mtime, &liststamp) != 5 ||
+			version != CACHEVERSION)
+		return;
+	if (!sameserver(&id, &c->id)) { /* server restarted ? */
+		c->dirty = 1;
+		return;
+	}
+	while (fgets(line, sizeof(line), fp)) {
+		if (readsink(pavc, line) < 0) { /* corrupted ? */
+			freeentries(pavc);
+			c->dirty = 1;
+			return;
+		}
+	}
+	c->liststamp = liststamp;
+	c->loaded = 1;
+}
+
+
+void pavc_cache_init(pavc_State *pavc)
+{
+	pavc_Cache *c;
+	const char *dir;
+	FILE *fp;
+	int n;
+
+	c = getcache(pavc);
+	if ((dir = getenv("XDG_RUNTIME_DIR")) == NULL || getserverid(&c->id) < 0)
+		return;
+	n = snprintf(c->path, sizeof(c->path), "%s/pavc.cache", dir);
+	if (n < 0 || (size_t)n >= sizeof(c->path))
+		return;
+	c->enabled = 1;
+	if ((fp = fopen(c->path, "r"))) {
+		load(pavc, fp);
+		fclose(fp);
+	}
+}
+
+
+/* cache is only an optimization, failing to write it is not an error */
+void pavc_cache_save(pavc_State *pavc)
+{
+	char tmp[PAVC_MAXPATH + 32];
+	pavc_Cache *c;
+	pavc_Cachesink *cs;
+	unsigned int i, j;
+	FILE *fp;
+	int err;
+
+	c = getcache(pavc);
+	if (!c->enabled || !c->dirty)
+		return;
+	snprintf(tmp, sizeof(tmp), "%s.%ld", c->path, (long)getpid());
+	if ((fp = fopen(tmp, "w")) == NULL)
+		return;
+	fprintf(fp, "pavc %u %lu %lu %ld %ld\n", CACHEVERSION, c->id.dev,
+			c->id.ino, c->id.mtime, c->liststamp);
+	for (i = 0; i < c->nsinks; i++) {
+		cs = &c->sinks[i];
+		if (strchr(cs->name, '\n'))
+			continue;
+		fprintf(fp, "sink %u %d %ld %u", cs->index, cs->mute, cs->stamp,
+				cs->volume.channels);
+		for (j = 0; j < cs->volume.channels; j++)
+			fprintf(fp, " %u", cs->volume.values[j]);
+		for (j = 0; j < cs->map.channels; j++)
+			fprintf(fp, " %d", (int)cs->map.map[j]);
+		fprintf(fp, " %s\n", cs->name);
+	}
+	err = ferror(fp);
+	if (fclose(fp) != 0 || err || rename(tmp, c->path) != 0)
+		remove(tmp);
+	else
+		c->dirty = 0;
+}
+
+
+void pavc_cache_free(pavc_State *pavc)
+{
+	pavc_Cache *c;
+
+	c = getcache(pavc);
+	freeentries(pavc);
+	if (c->sinks)
+		pavc_mem_freearray(pavc, c->sinks, c->sizesinks);
+	c->sinks = NULL;
+	c->sizesinks = 0;
+}
+
+
+void pavc_cache_invalidate(pavc_State *pavc)
+{
+	pavc_Cache *c;
+
+	c = getcache(pavc);
+	freeentries(pavc);
+	if (c->enabled)
+		remove(c->path);
+	c->liststamp = 0;
+	c->loaded = 0;
+	c->dirty = 0;
+}
+
+
+int pavc_cache_fresh(pavc_State *pavc, const pavc_Cachesink *cs)
+{
+	long now;
+
+	if (!getcache(pavc)->enabled)
+		return 0;
+	now = time(NULL);
+	return (cs->stamp <= now && now - cs->stamp <= PAVC_CACHETTL);
+}
+
+
+int pavc_cache_needlist(pavc_State *pavc)
+{
+	pavc_Cache *c;
+	long now;
+
+	c = getcache(pavc);
+	if (!c->enabled)
+		return 0;
+	if (!c->loaded)
+		return 1;
+	now = time(NULL);
+	return (c->liststamp > now || now - c->liststamp > PAVC_LISTTTL);
+}
+
+
+static void lockpath(pavc_Cache *c, char *buf, size_t size)
+{
+	snprintf(buf, size, "%s.lock", c->path);
+}
+
+
+/* lock holder that exited without releasing it leaves a stale lock */
+int pavc_cache_lock(pavc_State *pavc, long maxage)
+{
+	char path[PAVC_MAXPATH + 8];
+	struct stat st;
+	pavc_Cache *c;
+	int fd;
+
+	c = getcache(pavc);
+	if (!c->enabled)
+		return -1;
+	lockpath(c, path, sizeof(path));
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0) {
+		if (errno != EEXIST || stat(path, &st) < 0 ||
+				(st.st_mtime <= time(NULL) && time(NULL) - st.st_mtime <= maxage))
+			return -1;
+		remove(path);
+		if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600)) < 0)
+			return -1;
+	}
+	close(fd);
+	return 0;
+}
+
+
+void pavc_cache_unlock(pavc_State *pavc)
+{
+	char path[PAVC_MAXPATH + 8];
+
+	lockpath(getcache(pavc), path, sizeof(path));
+	remove(path);
+}
+
+
+const pavc_Cachesink *pavc_cache_find(pavc_State *pavc, const char *name)
+{
+	return findentry(getcache(pavc), name);
+}
+
+
+unsigned int pavc_cache_getsinkcount(pavc_State *pavc)
+{
+	return getcache(pavc)->nsinks;
+}
+
+
+const pavc_Cachesink *pavc_cache_getsink(pavc_State *pavc, unsigned int i)
+{
+	pavc_Cache *c;
+
+	c = getcache(pavc);
+	pavc_assert(i < c->nsinks);
+	return &c->sinks[i];
+}
+
+
+static void setentry(pavc_Cachesink *cs, const pa_sink_info *si, long now)
+{
+	cs->index = si->index;
+	cs->mute = si->mute;
+	cs->map = si->channel_map;
+	cs->volume = si->volume;
+	cs->stamp = now;
+}
+
+
+void pavc_cache_setsink(pavc_State *pavc, const pa_sink_info *si)
+{
+	pavc_Cache *c;
+	pavc_Cachesink *cs;
+
+	c = getcache(pavc);
+	if ((cs = findentry(c, si->name)) == NULL)
+		cs = newentry(pavc, si->name);
+	setentry(cs, si, time(NULL));
+	c->dirty = 1;
+}
+
+
+void pavc_cache_setvolume(pavc_State *pavc, uint32_t index, const pa_cvolume *cv)
+{
+	pavc_Cache *c;
+	pavc_Cachesink *cs;
+
+	c = getcache(pavc);
+	if ((cs = findentryindex(c, index))) {
+		cs->volume = *cv;
+		cs->stamp = time(NULL);
+		c->dirty = 1;
+	}
+}
+
+
+void pavc_cache_setmute(pavc_State *pavc, uint32_t index, int mute)
+{
+	pavc_Cache *c;
+	pavc_Cachesink *cs;
+
+	c = getcache(pavc);
+	if ((cs = findentryindex(c, index))) {
+		cs->mute = mute;
+		cs->stamp = time(NULL);
+		c->dirty = 1;
+	}
+}
+
+
+/* replace entries with the sinks in pavc_State sink array */
+void pavc_cache_rebuild(pavc_State *pavc)
+{
+	pavc_Cache *c;
+	const pa_sink_info *si;
+	unsigned int nsi, i;
+
+	c = getcache(pavc);
+	nsi = pavc_state_getsinkcount(pavc);
+	freeentries(pavc);
+	c->liststamp = time(NULL);
+	for (i = 0; i < nsi; i++) {
+		si = pavc_state_getsinkinfo(pavc, i);
+		setentry(newentry(pavc, si->name), si, c->liststamp);
+	}
+	c->dirty = 1;
+}
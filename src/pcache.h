@@ -0,0 +1,84 @@
+#ifndef PAVCCACHE_H
+#define PAVCCACHE_H
+
+
+#include "pcommon.h"
+
+
+/* seconds for which sink volume and mute state confirmed by the server
+ * are trusted */
+#if !defined(PAVC_CACHETTL)
+#define PAVC_CACHETTL		2
+#endif
+
+
+/* seconds after which the sink list is refreshed for shell completion */
+#if !defined(PAVC_LISTTTL)
+#define PAVC_LISTTTL		5
+#endif
+
+
+/* maximum length of cache file path */
+#define PAVC_MAXPATH		512
+
+
+/* identifies the server instance (its native socket) */
+typedef struct pavc_Serverid {
+	unsigned long dev;
+	unsigned long ino;
+	long mtime;
+} pavc_Serverid;
+
+
+/* cached sink metadata */
+typedef struct pavc_Cachesink {
+	char *name;
+	uint32_t index;
+	int mute;
+	pa_channel_map map;
+	pa_cvolume volume;
+	long stamp; /* time the server last confirmed this state */
+} pavc_Cachesink;
+
+
+typedef struct pavc_Cache {
+	pavc_Cachesink *sinks;
+	unsigned int nsinks; /* number of elements in 'sinks' */
+	unsigned int sizesinks; /* size of 'sinks' */
+	pavc_Serverid id; /* server the entries belong to */
+	long liststamp; /* time entries were last replaced by a full sink list */
+	unsigned char enabled; /* true if cache path and server id are known */
+	unsigned char loaded; /* true if entries were read from the cache file */
+	unsigned char dirty; /* true if entries need to be written back */
+	char path[PAVC_MAXPATH];
+} pavc_Cache;
+
+
+
+/* load/store cache file */
+void pavc_cache_init(pavc_State *pavc);
+void pavc_cache_save(pavc_State *pavc);
+void pavc_cache_free(pavc_State *pavc);
+void pavc_cache_invalidate(pavc_State *pavc);
+
+/* check if cached volume and mute state of 'cs' can be used */
+int pavc_cache_fresh(pavc_State *pavc, const pavc_Cachesink *cs);
+
+/* check if the sink list should be retrieved again */
+int pavc_cache_needlist(pavc_State *pavc);
+
+/* take/release the sink list refresh lock, lock older than 'maxage'
+ * seconds is taken over, returns -1 if lock is held by someone else */
+int pavc_cache_lock(pavc_State *pavc, long maxage);
+void pavc_cache_unlock(pavc_State *pavc);
+
+/* query/update entries (no PulseAudio operations) */
+const pavc_Cachesink *pavc_cache_find(pavc_State *pavc, const char *name);
+unsigned int pavc_cache_getsinkcount(pavc_State *pavc);
+const pavc_Cachesink *pavc_cache_getsink(pavc_State *pavc, unsigned int i);
+void pavc_cache_setsink(pavc_State *pavc, const pa_sink_info *si);
+void pavc_cache_setvolume(pavc_State *pavc, uint32_t index, const pa_cvolume *cv);
+void pavc_cache_setmute(pavc_State *pavc, uint32_t index, int mute);
+void pavc_cache_rebuild(pavc_State *pavc);
+
+#endif
@@ -38,6 +38,24 @@
 #define UNUSED(x) (void)(x)
 
 
+/* default deadlines in milliseconds (0 means no deadline) */
+#if !defined(PAVC_CONNECTTIMEOUT)
+#define PAVC_CONNECTTIMEOUT	2000
+#endif
+
+#if !defined(PAVC_LISTTIMEOUT)
+#define PAVC_LISTTIMEOUT	2000
+#endif
+
+#if !defined(PAVC_OPTIMEOUT)
+#define PAVC_OPTIMEOUT		2000
+#endif
+
+
+/* exit status in case a deadline expired */
+#define PAVC_EXITTIMEOUT	2
+
+
 /* state */
 typedef struct pavc_State pavc_State;
 
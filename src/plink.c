@@ -0,0 +1,346 @@
+#include <string.h>
+
+#include "plink.h"
+#include "pstate.h"
+#include "pmem.h"
+
+
+#define getlinks(pavc)		(&(pavc)->links)
+
+#define isbound(ls)		((ls)->index != PA_INVALID_INDEX)
+
+
+
+/*
+ * Sink change events don't say who made the change, so each write pavc
+ * makes is remembered on the member ('written'); when the member is
+ * retrieved after its change event and shows exactly that state the
+ * event is the echo of our own write and is not propagated. Any other
+ * volume or mute change is external and the member becomes the source
+ * of its group on the next synchronization.
+ */
+
+
+unsigned int pavc_link_newgroup(pavc_State *pavc)
+{
+	return getlinks(pavc)->ngroups++;
+}
+
+
+void pavc_link_add(pavc_State *pavc, unsigned int group, const char *name)
+{
+	pavc_Links *links;
+	pavc_Linksink *ls;
+	unsigned int i;
+
+	links = getlinks(pavc);
+	for (i = 0; i < links->ns; i++)
+		if (!strcmp(links->s[i].name, name))
+			pavc_state_error(pavc, "sink is linked more than once");
+	pavc_mem_growarray(pavc, links->s, &links->sizes, links->ns, UINT_MAX,
+				pavc_Linksink);
+	ls = &links->s[links->ns++];
+	memset(ls, 0, sizeof(*ls));
+	ls->name = pavc_mem_strdup(pavc, name);
+	ls->index = PA_INVALID_INDEX;
+	ls->group = group;
+}
+
+
+void pavc_link_free(pavc_State *pavc)
+{
+	pavc_Links *links;
+
+	links = getlinks(pavc);
+	while (links->ns > 0) {
+		links->ns--;
+		pavc_mem_free(pavc, links->s[links->ns].name,
+				strlen(links->s[links->ns].name) + 1);
+	}
+	if (links->s)
+		pavc_mem_freearray(pavc, links->s, links->sizes);
+	links->s = NULL;
+	links->sizes = 0;
+}
+
+
+static pavc_Linksink *findindex(pavc_Links *links, uint32_t index)
+{
+	unsigned int i;
+
+	for (i = 0; i < links->ns; i++)
+		if (links->s[i].index == index)
+			return &links->s[i];
+	return NULL;
+}
+
+
+static pavc_Linksink *findname(pavc_Links *links, const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < links->ns; i++)
+		if (!strcmp(links->s[i].name, name))
+			return &links->s[i];
+	return NULL;
+}
+
+
+static void eventcb(pa_context *c, pa_subscription_event_type_t t, uint32_t idx, void *ud)
+{
+	pavc_State *pavc;
+	pavc_Links *links;
+	pavc_Linksink *ls;
+
+	UNUSED(c);
+	pavc = (pavc_State*)ud;
+	links = getlinks(pavc);
+	if ((t & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) != PA_SUBSCRIPTION_EVENT_SINK)
+		return;
+	switch (t & PA_SUBSCRIPTION_EVENT_TYPE_MASK) {
+	case PA_SUBSCRIPTION_EVENT_NEW: /* might be one of ours (by name) */
+		links->rescan = 1;
+		break;
+	case PA_SUBSCRIPTION_EVENT_CHANGE:
+		if ((ls = findindex(links, idx))) {
+			ls->changed = 1;
+			ls->seq = ++links->seq; /* latest event wins if several changed */
+		}
+		break;
+	case PA_SUBSCRIPTION_EVENT_REMOVE:
+		if ((ls = findindex(links, idx))) {
+			ls->index = PA_INVALID_INDEX;
+			ls->changed = ls->written = ls->source = 0;
+		}
+		break;
+	default:
+		return;
+	}
+	pavc_state_signalthreadedml(pavc, 0);
+}
+
+
+/* update member from retrieved sink information */
+static void update(pavc_Linksink *ls, const pa_sink_info *si)
+{
+	int ours;
+
+	if (!isbound(ls)) { /* (re)appeared, takes state of its group */
+		ls->index = si->index;
+		ls->joined = 1;
+		ls->written = 0;
+	} else if (ls->written) {
+		ours = (si->mute == ls->wmute && pa_cvolume_equal(&si->volume, &ls->wvolume));
+		ls->written = 0;
+		ls->source = !ours;
+	} else if (si->mute != ls->mute || !pa_cvolume_equal(&si->volume, &ls->volume)) {
+		ls->source = 1;
+	}
+	ls->map = si->channel_map;
+	ls->volume = si->volume;
+	ls->mute = si->mute;
+}
+
+
+static void sinkinfocb(pa_context *c, const pa_sink_info *si, int eol, void *ud)
+{
+	pavc_State *pavc;
+	pavc_Links *links;
+	pavc_Linksink *ls;
+
+	UNUSED(c);
+	pavc = (pavc_State*)ud;
+	links = getlinks(pavc);
+	if (si && (ls = findname(links, si->name)))
+		update(ls, si);
+	if (eol) links->npending--; /* eol < 0 if sink is already gone */
+	pavc_state_signalthreadedml(pavc, 0);
+}
+
+
+static void successcb(pa_context *c, int success, void *ud)
+{
+	pavc_State *pavc;
+
+	UNUSED(c);
+	pavc = (pavc_State*)ud;
+	getlinks(pavc)->npending--;
+	if (!success) /* sink vanished meanwhile ? */
+		getlinks(pavc)->rescan = 1;
+	pavc_state_signalthreadedml(pavc, 0);
+}
+
+
+/* issued operations are not waited on one by one, 'npending' tracks them */
+static void pipeline(pavc_State *pavc)
+{
+	if (!pavc_state_haveop(pavc))
+		pavc_state_error(pavc, "failed to issue sink operation");
+	getlinks(pavc)->npending++;
+	pavc_state_removeop(pavc);
+}
+
+
+static int waitpending(pavc_State *pavc)
+{
+	pavc_Links *links;
+
+	links = getlinks(pavc);
+	while (links->npending > 0) {
+		if (!pavc_state_connected(pavc))
+			pavc_state_error(pavc, "connection to the server was lost");
+		if (pavc_state_expired(pavc)) { /* state of the members is unknown */
+			links->rescan = 1;
+			return -1;
+		}
+		pavc_state_waitthreadedml(pavc);
+	}
+	return 0;
+}
+
+
+static void subscribecb(pa_context *c, int success, void *ud)
+{
+	pavc_State *pavc;
+
+	UNUSED(c);
+	pavc = (pavc_State*)ud;
+	getlinks(pavc)->subscribed = (success != 0);
+	pavc_state_signalthreadedml(pavc, 0);
+}
+
+
+void pavc_link_subscribe(pavc_State *pavc)
+{
+	pavc_state_subscribe(pavc, PA_SUBSCRIPTION_MASK_SINK, eventcb, subscribecb, pavc);
+	if (!pavc_state_haveop(pavc))
+		pavc_state_error(pavc, "failed to subscribe to sink events");
+	if (pavc_state_waitopstate(pavc, PA_OPERATION_DONE) < 0)
+		pavc_state_timeout(pavc, "timed out subscribing to sink events");
+	pavc_state_removeop(pavc);
+	if (!getlinks(pavc)->subscribed)
+		pavc_state_error(pavc, pavc_state_getoperrormsg(pavc));
+	getlinks(pavc)->rescan = 1; /* initial sink list */
+}
+
+
+int pavc_link_pending(pavc_State *pavc)
+{
+	pavc_Links *links;
+	unsigned int i;
+
+	links = getlinks(pavc);
+	if (links->rescan)
+		return 1;
+	for (i = 0; i < links->ns; i++)
+		if (links->s[i].changed)
+			return 1;
+	return 0;
+}
+
+
+/* retrieve all sinks with change events (or the whole list) in one batch */
+int pavc_link_refresh(pavc_State *pavc)
+{
+	pavc_Links *links;
+	unsigned int i;
+
+	links = getlinks(pavc);
+	if (links->rescan) {
+		links->rescan = 0;
+		for (i = 0; i < links->ns; i++)
+			links->s[i].changed = 0;
+		pavc_state_getsinkinfolist(pavc, sinkinfocb, pavc);
+		pipeline(pavc);
+	} else {
+		for (i = 0; i < links->ns; i++) {
+			if (links->s[i].changed && isbound(&links->s[i])) {
+				links->s[i].changed = 0;
+				pavc_state_getsinkinfoindex(pavc, links->s[i].index, sinkinfocb, pavc);
+				pipeline(pavc);
+			}
+		}
+	}
+	return waitpending(pavc);
+}
+
+
+/*
+ * Member the group takes its state from: the latest external change,
+ * otherwise a member that was already in sync (so appearing sinks adopt
+ * the group state), otherwise the first present member. Returns NULL if
+ * group doesn't need synchronizing.
+ */
+static pavc_Linksink *groupsource(pavc_Links *links, unsigned int first, unsigned int last)
+{
+	pavc_Linksink *ls, *best;
+	int rank, bestrank, needsync;
+	unsigned int i;
+
+	best = NULL;
+	bestrank = -1;
+	needsync = 0;
+	for (i = first; i < last; i++) {
+		ls = &links->s[i];
+		if (!isbound(ls))
+			continue;
+		needsync |= (ls->source | ls->joined);
+		rank = (ls->source ? 2 : !ls->joined);
+		if (rank > bestrank || (rank == bestrank && rank > 0 && ls->seq > best->seq)) {
+			best = ls;
+			bestrank = rank;
+		}
+	}
+	return (needsync ? best : NULL);
+}
+
+
+/* write the state of 'src' to 'ls' (if it differs) */
+static void syncmember(pavc_State *pavc, const pavc_Linksink *src, pavc_Linksink *ls)
+{
+	pa_sink_info si;
+	pa_cvolume cv;
+
+	memset(&si, 0, sizeof(si));
+	si.index = ls->index;
+	cv = src->volume;
+	if (!pa_channel_map_equal(&src->map, &ls->map))
+		pa_cvolume_remap(&cv, &src->map, &ls->map);
+	ls->wvolume = ls->volume;
+	ls->wmute = ls->mute;
+	if (!pa_cvolume_equal(&cv, &ls->volume)) {
+		pavc_state_setsinkvolumeindex(pavc, &si, &cv, successcb, pavc);
+		pipeline(pavc);
+		ls->wvolume = cv;
+		ls->written = 1;
+	}
+	if (src->mute != ls->mute) {
+		pavc_state_setsinkmuteindex(pavc, &si, src->mute, successcb, pavc);
+		pipeline(pavc);
+		ls->wmute = src->mute;
+		ls->written = 1;
+	}
+}
+
+
+/* send the state of each group source to the rest of its group in one batch */
+int pavc_link_propagate(pavc_State *pavc)
+{
+	pavc_Links *links;
+	pavc_Linksink *src;
+	unsigned int first, last, i;
+
+	links = getlinks(pavc);
+	for (first = 0; first < links->ns; first = last) {
+		for (last = first; last < links->ns && links->s[last].group == links->s[first].group;)
+			last++;
+		if ((src = groupsource(links, first, last)) == NULL)
+			continue;
+		for (i = first; i < last; i++) {
+			if (&links->s[i] != src && isbound(&links->s[i]))
+				syncmember(pavc, src, &links->s[i]);
+			links->s[i].source = links->s[i].joined = 0;
+		}
+	}
+	return waitpending(pavc);
+}
@@ -0,0 +1,62 @@
+#ifndef PAVCLINK_H
+#define PAVCLINK_H
+
+
+#include "pcommon.h"
+
+
+/* msec to wait for more sink events before synchronizing (debounce) */
+#if !defined(PAVC_LINKDEBOUNCE)
+#define PAVC_LINKDEBOUNCE	50
+#endif
+
+
+/* member of a group of linked sinks */
+typedef struct pavc_Linksink {
+	char *name;
+	uint32_t index; /* PA_INVALID_INDEX if sink is not present */
+	unsigned int group; /* group the sink belongs to */
+	unsigned long seq; /* order of the last change event, 0 if none */
+	pa_channel_map map;
+	pa_cvolume volume; /* last seen volume */
+	int mute; /* last seen mute state */
+	pa_cvolume wvolume; /* volume written by pavc */
+	int wmute; /* mute state written by pavc */
+	unsigned char written; /* true if 'wvolume' and 'wmute' are not yet seen */
+	unsigned char changed; /* true if sink change event was received */
+	unsigned char source; /* true if changed externally since last sync */
+	unsigned char joined; /* true if sink appeared since last sync */
+} pavc_Linksink;
+
+
+typedef struct pavc_Links {
+	pavc_Linksink *s;
+	unsigned int ns; /* number of elements in 's' */
+	unsigned int sizes; /* size of 's' */
+	unsigned int ngroups; /* number of groups */
+	unsigned long seq; /* change event counter */
+	unsigned int npending; /* operations in flight */
+	unsigned char rescan; /* true if sink list needs to be retrieved */
+	unsigned char subscribed; /* true if subscribed to sink events */
+} pavc_Links;
+
+
+
+/* declare groups (members of a group are added after creating it) */
+unsigned int pavc_link_newgroup(pavc_State *pavc);
+void pavc_link_add(pavc_State *pavc, unsigned int group, const char *name);
+void pavc_link_free(pavc_State *pavc);
+
+/* (event loop) subscribe to sink events */
+void pavc_link_subscribe(pavc_State *pavc);
+
+/* check if sink events are waiting to be handled */
+int pavc_link_pending(pavc_State *pavc);
+
+/* (event loop) retrieve changed sinks and propagate the changes, each
+ * returns -1 if the deadline expired (the sink list is then retrieved
+ * again on the next refresh) */
+int pavc_link_refresh(pavc_State *pavc);
+int pavc_link_propagate(pavc_State *pavc);
+
+#endif
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "pmem.h"
 #include "pstate.h"
 
@@ -54,3 +56,15 @@ void pavc_mem_free(pavc_State *pavc, void *block, size_t osize)
 {
 	pavc->alloc(block, pavc->ud, osize, 0);
 }
+
+
+char *pavc_mem_strdup(pavc_State *pavc, const char *str)
+{
+	char *dup;
+	size_t size;
+
+	size = strlen(str) + 1;
+	dup = (char*)pavc_mem_malloc(pavc, size);
+	memcpy(dup, str, size);
+	return dup;
+}
@@ -11,6 +11,7 @@
 void *pavc_mem_realloc(pavc_State *pavc, void* ptr, size_t osize, size_t size);
 void *pavc_mem_malloc(pavc_State *pavc, size_t size);
 void pavc_mem_free(pavc_State *pavc, void *ptr, size_t osize);
+char *pavc_mem_strdup(pavc_State *pavc, const char *str);
 
 void *pavc_mem_growarray_(pavc_State *pavc, void *block, unsigned int *sizep, 
 				unsigned int len, unsigned int limit, int elemsize);
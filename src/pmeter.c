@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pmeter.h"
+#include "pstate.h"
+#include "pmem.h"
+
+
+#define getmeters(pavc)		(&(pavc)->meters)
+
+
+
+/*
+ * Interleaved samples are consumed 'PAVC_METERLANES' frames at a time,
+ * each sample position in that block has its own accumulator (lane), so
+ * the inner loop runs over contiguous memory without a per-channel
+ * stride and gets vectorized; lanes are folded per channel when printed.
+ * Samples are already a peak envelope ('PA_STREAM_PEAK_DETECT'), the
+ * server does the heavy lifting and only 'PAVC_METERRATE' frames per
+ * second reach this loop. The envelope carries no signal power, so
+ * only the peak is measured.
+ */
+void pavc_meter_scan(const float *restrict buf, size_t nframes, unsigned int nch,
+			float *restrict peak)
+{
+	unsigned int w, k;
+	float x;
+
+	while (nframes > 0) {
+		w = (nframes < PAVC_METERLANES ? nframes : PAVC_METERLANES);
+		nframes -= w;
+		w *= nch;
+		for (k = 0; k < w; k++) {
+			x = fabsf(buf[k]);
+			peak[k] = (x > peak[k] ? x : peak[k]);
+		}
+		buf += w;
+	}
+}
+
+
+static void readcb(pa_stream *s, size_t nbytes, void *ud)
+{
+	pavc_Meter *m;
+	const void *data;
+	size_t framesize;
+
+	UNUSED(nbytes);
+	m = (pavc_Meter*)ud;
+	if (pa_stream_peek(s, &data, &nbytes) < 0 || nbytes == 0)
+		return;
+	if (data) { /* not a hole ? */
+		framesize = m->map.channels * sizeof(float);
+		pavc_meter_scan((const float*)data, nbytes / framesize,
+				m->map.channels, m->peak);
+	}
+	pa_stream_drop(s);
+}
+
+
+static void freemeter(pavc_State *pavc, pavc_Meter *m)
+{
+	if (m->stream) {
+		pa_stream_set_read_callback(m->stream, NULL, NULL);
+		pa_stream_disconnect(m->stream);
+		pa_stream_unref(m->stream);
+	}
+	pavc_mem_free(pavc, m->name, strlen(m->name) + 1);
+	pavc_mem_free(pavc, m, sizeof(*m));
+}
+
+
+void pavc_meter_new(pavc_State *pavc, const pa_sink_info *si)
+{
+	pavc_Meters *ms;
+	pavc_Meter *m;
+	pa_sample_spec ss;
+	pa_buffer_attr attr;
+	char dev[16];
+	const char *devname;
+
+	ms = getmeters(pavc);
+	pavc_mem_growarray(pavc, ms->m, &ms->sizem, ms->nm, UINT_MAX, pavc_Meter*);
+	m = (pavc_Meter*)pavc_mem_malloc(pavc, sizeof(*m));
+	memset(m, 0, sizeof(*m));
+	m->name = pavc_mem_strdup(pavc, si->name);
+	m->map = si->channel_map;
+	ms->m[ms->nm++] = m;
+	ss.format = PA_SAMPLE_FLOAT32NE;
+	ss.rate = PAVC_METERRATE;
+	ss.channels = m->map.channels;
+	if (!pa_sample_spec_valid(&ss))
+		pavc_state_error(pavc, "invalid sink channel map");
+	if ((m->stream = pa_stream_new(pavc->ctx, "pavc meter", &ss, &m->map)) == NULL)
+		pavc_state_error(pavc, "couldn't create record stream");
+	pa_stream_set_read_callback(m->stream, readcb, m);
+	memset(&attr, 0xff, sizeof(attr));
+	attr.fragsize = pa_frame_size(&ss) * (PAVC_METERRATE / PAVC_METERHZ);
+	if ((devname = si->monitor_source_name) == NULL) {
+		snprintf(dev, sizeof(dev), "%u", si->monitor_source);
+		devname = dev;
+	}
+	if (pa_stream_connect_record(m->stream, devname, &attr, PA_STREAM_PEAK_DETECT |
+				PA_STREAM_ADJUST_LATENCY | PA_STREAM_DONT_MOVE |
+				PA_STREAM_DONT_INHIBIT_AUTO_SUSPEND) < 0)
+		pavc_state_error(pavc, "couldn't connect record stream");
+}
+
+
+/*
+ * One line per sink, tab separated: sink name followed by
+ * 'position:peak' for each channel (linear, 0..1).
+ */
+static void printmeter(pavc_Meter *m, FILE *fp)
+{
+	unsigned int nch, c, l;
+	float peak;
+
+	nch = m->map.channels;
+	fputs(m->name, fp);
+	for (c = 0; c < nch; c++) {
+		peak = 0.0f;
+		for (l = c; l < PAVC_METERLANES * nch; l += nch) /* fold lanes */
+			peak = (m->peak[l] > peak ? m->peak[l] : peak);
+		fprintf(fp, "\t%s:%.4f", pa_channel_position_to_string(m->map.map[c]),
+				(double)peak);
+	}
+	fputc('\n', fp);
+	memset(m->peak, 0, sizeof(m->peak));
+}
+
+
+unsigned int pavc_meter_print(pavc_State *pavc, FILE *fp)
+{
+	pavc_Meters *ms;
+	pa_stream_state_t state;
+	unsigned int i;
+
+	ms = getmeters(pavc);
+	for (i = 0; i < ms->nm; ) {
+		state = pa_stream_get_state(ms->m[i]->stream);
+		if (state == PA_STREAM_FAILED || state == PA_STREAM_TERMINATED) {
+			freemeter(pavc, ms->m[i]); /* sink is gone */
+			ms->m[i] = ms->m[--ms->nm];
+			continue;
+		}
+		printmeter(ms->m[i++], fp);
+	}
+	fflush(fp);
+	return ms->nm;
+}
+
+
+void pavc_meter_free(pavc_State *pavc)
+{
+	pavc_Meters *ms;
+
+	ms = getmeters(pavc);
+	while (ms->nm > 0)
+		freemeter(pavc, ms->m[--ms->nm]);
+	if (ms->m)
+		pavc_mem_freearray(pavc, ms->m, ms->sizem);
+	ms->m = NULL;
+	ms->sizem = 0;
+}
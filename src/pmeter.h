@@ -0,0 +1,54 @@
+#ifndef PAVCMETER_H
+#define PAVCMETER_H
+
+
+#include <stdio.h>
+
+#include "pcommon.h"
+
+
+/* sample rate of the peak envelope requested from the server */
+#if !defined(PAVC_METERRATE)
+#define PAVC_METERRATE		200
+#endif
+
+/* meter refresh rate (per second) */
+#if !defined(PAVC_METERHZ)
+#define PAVC_METERHZ		10
+#endif
+
+
+/* frames accumulated side by side by the scan kernel */
+#define PAVC_METERLANES		8
+
+
+/* level meter of a single sink (record stream on its monitor source) */
+typedef struct pavc_Meter {
+	pa_stream *stream;
+	char *name; /* sink name */
+	pa_channel_map map;
+	float peak[PAVC_METERLANES * PA_CHANNELS_MAX]; /* per-lane peak */
+} pavc_Meter;
+
+
+typedef struct pavc_Meters {
+	pavc_Meter **m;
+	unsigned int nm; /* number of elements in 'm' */
+	unsigned int sizem; /* size of 'm' */
+} pavc_Meters;
+
+
+
+/* (kernel) accumulate peak into 'PAVC_METERLANES' lanes */
+void pavc_meter_scan(const float *restrict buf, size_t nframes, unsigned int nch,
+			float *restrict peak);
+
+/* create meter for sink (performs PulseAudio operation) */
+void pavc_meter_new(pavc_State *pavc, const pa_sink_info *si);
+
+/* print and reset meters, returns number of meters still running */
+unsigned int pavc_meter_print(pavc_State *pavc, FILE *fp);
+
+void pavc_meter_free(pavc_State *pavc);
+
+#endif
@@ -0,0 +1,759 @@
+#include <pulse/rtclock.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "pnative.h"
+#include "pstate.h"
+#include "pmem.h"
+
+
+/*
+ * Only the handful of requests pavc needs are implemented, without
+ * shared memory, so the server sends everything over the socket.
+ * Packet: descriptor (length, channel, offset hi/lo, flags; 32 bit big
+ * endian) followed by a tagstruct, each tagstruct value is prefixed by
+ * its type tag. Layouts follow 'pulsecore/protocol-native.c'.
+ */
+
+
+/* commands */
+#define CMD_ERROR		0
+#define CMD_REPLY		2
+#define CMD_AUTH		8
+#define CMD_SETCLIENTNAME	9
+#define CMD_GETSINKINFO		21
+#define CMD_GETSINKINFOLIST	22
+#define CMD_SETSINKVOLUME	36
+#define CMD_SETSINKMUTE		39
+
+
+/* tagstruct tags */
+#define TAG_STRING		't'
+#define TAG_STRINGNULL		'N'
+#define TAG_U32			'L'
+#define TAG_U8			'B'
+#define TAG_SAMPLESPEC		'a'
+#define TAG_ARBITRARY		'x'
+#define TAG_TRUE		'1'
+#define TAG_FALSE		'0'
+#define TAG_USEC		'U'
+#define TAG_CHANNELMAP		'm'
+#define TAG_CVOLUME		'v'
+#define TAG_PROPLIST		'P'
+#define TAG_VOLUME		'V'
+#define TAG_FORMATINFO		'f'
+
+
+#define DESCSIZE	20 /* size of packet descriptor */
+#define CTLCHANNEL	0xffffffffU /* channel of control packets */
+#define MAXFRAME	(16U * 1024U * 1024U) /* maximum payload size */
+#define MAXREQUEST	4096 /* maximum request payload size */
+#define COOKIESIZE	256
+#define VERSIONMASK	0x0000ffffU /* upper bits are shm/memfd flags */
+#define MINVERSION	13 /* proplists (client name) */
+
+
+#define getnative(pavc)		(&(pavc)->native)
+
+
+
+/* -------------------------------------------------------------------------
+ * Socket I/O
+ * ------------------------------------------------------------------------- */
+
+
+/* wait until 'fd' is ready, returns -2 if the deadline expired */
+static int waitfd(pavc_State *pavc, short events)
+{
+	pavc_Native *n;
+	struct pollfd pfd;
+	pa_usec_t now;
+	int msec, res;
+
+	n = getnative(pavc);
+	pfd.fd = n->fd;
+	pfd.events = events;
+	for (;;) {
+		msec = -1;
+		if (n->deadline) {
+			if ((now = pa_rtclock_now()) >= n->deadline) {
+				pavc->expired = 1;
+				return -2;
+			}
+			msec = (n->deadline - now + PA_USEC_PER_MSEC - 1) / PA_USEC_PER_MSEC;
+		}
+		if ((res = poll(&pfd, 1, msec)) > 0)
+			return 0;
+		if (res < 0 && errno != EINTR)
+			return -1;
+	}
+}
+
+
+static int writeall(pavc_State *pavc, const unsigned char *buf, size_t size)
+{
+	ssize_t res;
+	int err;
+
+	while (size > 0) {
+		if ((err = waitfd(pavc, POLLOUT)) < 0)
+			return err;
+		res = send(getnative(pavc)->fd, buf, size, MSG_NOSIGNAL);
+		if (res < 0 && errno != EINTR && errno != EAGAIN)
+			return -1;
+		if (res > 0) {
+			buf += res;
+			size -= res;
+		}
+	}
+	return 0;
+}
+
+
+static int readall(pavc_State *pavc, unsigned char *buf, size_t size)
+{
+	ssize_t res;
+	int err;
+
+	while (size > 0) {
+		if ((err = waitfd(pavc, POLLIN)) < 0)
+			return err;
+		res = read(getnative(pavc)->fd, buf, size);
+		if (res == 0 || (res < 0 && errno != EINTR && errno != EAGAIN))
+			return -1; /* disconnected or failed */
+		if (res > 0) {
+			buf += res;
+			size -= res;
+		}
+	}
+	return 0;
+}
+
+
+static void putbe32(unsigned char *p, uint32_t x)
+{
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+
+static uint32_t getbe32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+		((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+
+
+/* -------------------------------------------------------------------------
+ * Requests
+ * ------------------------------------------------------------------------- */
+
+
+typedef struct Request {
+	unsigned char buf[DESCSIZE + MAXREQUEST];
+	size_t n; /* size of payload */
+	uint32_t tag;
+	int overflow; /* true if payload didn't fit */
+} Request;
+
+
+static void putbytes(Request *r, const void *p, size_t size)
+{
+	if (r->overflow || size > MAXREQUEST - r->n) {
+		r->overflow = 1;
+		return;
+	}
+	memcpy(r->buf + DESCSIZE + r->n, p, size);
+	r->n += size;
+}
+
+
+static void putbyte(Request *r, unsigned char c)
+{
+	putbytes(r, &c, 1);
+}
+
+
+static void putraw32(Request *r, uint32_t x)
+{
+	unsigned char b[4];
+
+	putbe32(b, x);
+	putbytes(r, b, 4);
+}
+
+
+static void putu32(Request *r, uint32_t x)
+{
+	putbyte(r, TAG_U32);
+	putraw32(r, x);
+}
+
+
+static void putstring(Request *r, const char *s)
+{
+	if (s) {
+		putbyte(r, TAG_STRING);
+		putbytes(r, s, strlen(s) + 1);
+	} else {
+		putbyte(r, TAG_STRINGNULL);
+	}
+}
+
+
+static void putarbitrary(Request *r, const void *p, uint32_t size)
+{
+	putbyte(r, TAG_ARBITRARY);
+	putraw32(r, size);
+	putbytes(r, p, size);
+}
+
+
+static void putbool(Request *r, int b)
+{
+	putbyte(r, (b ? TAG_TRUE : TAG_FALSE));
+}
+
+
+static void putcvolume(Request *r, const pa_cvolume *cv)
+{
+	unsigned int i;
+
+	putbyte(r, TAG_CVOLUME);
+	putbyte(r, cv->channels);
+	for (i = 0; i < cv->channels; i++)
+		putraw32(r, cv->values[i]);
+}
+
+
+static void newrequest(pavc_State *pavc, Request *r, uint32_t command)
+{
+	r->n = 0;
+	r->overflow = 0;
+	r->tag = getnative(pavc)->tag++;
+	putu32(r, command);
+	putu32(r, r->tag);
+}
+
+
+static int sendrequest(pavc_State *pavc, Request *r)
+{
+	if (r->overflow)
+		pavc_state_error(pavc, "request too large");
+	putbe32(r->buf, r->n);
+	putbe32(r->buf + 4, CTLCHANNEL);
+	putbe32(r->buf + 8, 0);
+	putbe32(r->buf + 12, 0);
+	putbe32(r->buf + 16, 0);
+	return writeall(pavc, r->buf, DESCSIZE + r->n);
+}
+
+
+
+/* -------------------------------------------------------------------------
+ * Replies
+ * ------------------------------------------------------------------------- */
+
+
+typedef struct Reply {
+	unsigned char *pkt; /* payload */
+	uint32_t size; /* size of 'pkt' */
+	const unsigned char *p; /* read position */
+	int err; /* true if payload is malformed */
+} Reply;
+
+
+static int need(Reply *r, size_t size)
+{
+	if (r->err || (size_t)(r->pkt + r->size - r->p) < size) {
+		r->err = 1;
+		return 0;
+	}
+	return 1;
+}
+
+
+static int gettag(Reply *r, unsigned char tag)
+{
+	if (!need(r, 1) || *r->p != tag) {
+		r->err = 1;
+		return 0;
+	}
+	r->p++;
+	return 1;
+}
+
+
+static uint32_t getraw32(Reply *r)
+{
+	uint32_t x;
+
+	if (!need(r, 4))
+		return 0;
+	x = getbe32(r->p);
+	r->p += 4;
+	return x;
+}
+
+
+static uint32_t getu32(Reply *r)
+{
+	return (gettag(r, TAG_U32) ? getraw32(r) : 0);
+}
+
+
+static uint8_t getu8(Reply *r)
+{
+	if (!gettag(r, TAG_U8) || !need(r, 1))
+		return 0;
+	return *r->p++;
+}
+
+
+static pa_usec_t getusec(Reply *r)
+{
+	pa_usec_t hi;
+
+	if (!gettag(r, TAG_USEC))
+		return 0;
+	hi = getraw32(r);
+	return (hi << 32) | getraw32(r);
+}
+
+
+static const char *getstring(Reply *r)
+{
+	const char *s;
+	const unsigned char *end;
+
+	if (need(r, 1) && *r->p == TAG_STRINGNULL) {
+		r->p++;
+		return NULL;
+	}
+	if (!gettag(r, TAG_STRING))
+		return NULL;
+	end = memchr(r->p, '\0', r->pkt + r->size - r->p);
+	if (end == NULL) {
+		r->err = 1;
+		return NULL;
+	}
+	s = (const char*)r->p;
+	r->p = end + 1;
+	return s;
+}
+
+
+static int getbool(Reply *r)
+{
+	if (need(r, 1) && (*r->p == TAG_TRUE || *r->p == TAG_FALSE))
+		return (*r->p++ == TAG_TRUE);
+	r->err = 1;
+	return 0;
+}
+
+
+static void getsamplespec(Reply *r, pa_sample_spec *ss)
+{
+	if (!gettag(r, TAG_SAMPLESPEC) || !need(r, 2))
+		return;
+	ss->format = (pa_sample_format_t)r->p[0];
+	ss->channels = r->p[1];
+	r->p += 2;
+	ss->rate = getraw32(r);
+}
+
+
+static void getchannelmap(Reply *r, pa_channel_map *map)
+{
+	unsigned int i;
+
+	if (!gettag(r, TAG_CHANNELMAP) || !need(r, 1))
+		return;
+	map->channels = *r->p++;
+	if (map->channels > PA_CHANNELS_MAX || !need(r, map->channels)) {
+		r->err = 1;
+		return;
+	}
+	for (i = 0; i < map->channels; i++)
+		map->map[i] = (pa_channel_position_t)r->p[i];
+	r->p += map->channels;
+}
+
+
+static void getcvolume(Reply *r, pa_cvolume *cv)
+{
+	unsigned int i;
+
+	if (!gettag(r, TAG_CVOLUME) || !need(r, 1))
+		return;
+	cv->channels = *r->p++;
+	if (cv->channels > PA_CHANNELS_MAX) {
+		r->err = 1;
+		return;
+	}
+	for (i = 0; i < cv->channels; i++)
+		cv->values[i] = getraw32(r);
+}
+
+
+static pa_volume_t getvolume(Reply *r)
+{
+	return (gettag(r, TAG_VOLUME) ? getraw32(r) : 0);
+}
+
+
+static void skipproplist(Reply *r)
+{
+	uint32_t size;
+
+	if (!gettag(r, TAG_PROPLIST))
+		return;
+	while (!r->err) {
+		if (need(r, 1) && *r->p == TAG_STRINGNULL) { /* end of list */
+			r->p++;
+			return;
+		}
+		getstring(r); /* key */
+		getu32(r); /* value size */
+		if (gettag(r, TAG_ARBITRARY)) {
+			size = getraw32(r);
+			if (need(r, size))
+				r->p += size;
+		}
+	}
+}
+
+
+static void skipformatinfo(Reply *r)
+{
+	if (gettag(r, TAG_FORMATINFO)) {
+		getu8(r); /* encoding */
+		skipproplist(r);
+	}
+}
+
+
+static void freereply(pavc_State *pavc, Reply *r)
+{
+	if (r->pkt)
+		pavc_mem_free(pavc, r->pkt, r->size);
+	r->pkt = NULL;
+}
+
+
+static int recvpacket(pavc_State *pavc, Reply *r)
+{
+	unsigned char desc[DESCSIZE];
+	int err;
+
+	r->pkt = NULL;
+	if ((err = readall(pavc, desc, DESCSIZE)) < 0)
+		return err;
+	r->size = getbe32(desc);
+	if (r->size == 0 || r->size > MAXFRAME)
+		return -1;
+	r->pkt = (unsigned char*)pavc_mem_malloc(pavc, r->size);
+	if ((err = readall(pavc, r->pkt, r->size)) < 0) {
+		freereply(pavc, r);
+		return err;
+	}
+	r->p = r->pkt;
+	r->err = 0;
+	if (getbe32(desc + 4) != CTLCHANNEL) /* memblock ? */
+		r->err = 1;
+	return 0;
+}
+
+
+/*
+ * Wait for reply to request 'tag', unrelated packets are dropped.
+ * Returns 0 if server replied, -1 if it replied with an error
+ * ('error' is set) or on I/O failure and -2 if deadline expired.
+ */
+static int waitreply(pavc_State *pavc, uint32_t tag, Reply *r)
+{
+	pavc_Native *n;
+	uint32_t command;
+	int err;
+
+	n = getnative(pavc);
+	for (;;) {
+		if ((err = recvpacket(pavc, r)) < 0) {
+			n->error = (err == -2 ? PA_ERR_TIMEOUT : PA_ERR_CONNECTIONTERMINATED);
+			return err;
+		}
+		command = getu32(r);
+		if (!r->err && getu32(r) == tag && !r->err) {
+			if (command == CMD_REPLY)
+				return 0;
+			if (command == CMD_ERROR) {
+				n->error = getu32(r);
+				if (r->err) n->error = PA_ERR_PROTOCOL;
+				freereply(pavc, r);
+				return -1;
+			}
+		}
+		freereply(pavc, r);
+	}
+}
+
+
+/* send request and wait for an empty reply */
+static int transact(pavc_State *pavc, Request *req)
+{
+	Reply r;
+	int err;
+
+	if ((err = sendrequest(pavc, req)) < 0) {
+		getnative(pavc)->error = PA_ERR_CONNECTIONTERMINATED;
+		return err;
+	}
+	if ((err = waitreply(pavc, req->tag, &r)) < 0)
+		return err;
+	freereply(pavc, &r);
+	return 0;
+}
+
+
+
+/* -------------------------------------------------------------------------
+ * Backend
+ * ------------------------------------------------------------------------- */
+
+
+int pavc_native_socketpath(char *buf, size_t size)
+{
+	const char *dir;
+	int n;
+
+	if (getenv("PULSE_SERVER")) /* custom server (could be remote) */
+		return -1;
+	if ((dir = getenv("PULSE_RUNTIME_PATH")))
+		n = snprintf(buf, size, "%s/native", dir);
+	else if ((dir = getenv("XDG_RUNTIME_DIR")))
+		n = snprintf(buf, size, "%s/pulse/native", dir);
+	else
+		return -1;
+	return (n < 0 || (size_t)n >= size ? -1 : 0);
+}
+
+
+/* missing cookie is sent as zeros, server may still accept it */
+static void readcookie(unsigned char *cookie)
+{
+	char path[PAVC_MAXPATH];
+	const char *env;
+	FILE *fp;
+
+	memset(cookie, 0, COOKIESIZE);
+	if ((env = getenv("PULSE_COOKIE")))
+		snprintf(path, sizeof(path), "%s", env);
+	else if ((env = getenv("XDG_CONFIG_HOME")))
+		snprintf(path, sizeof(path), "%s/pulse/cookie", env);
+	else if ((env = getenv("HOME")))
+		snprintf(path, sizeof(path), "%s/.config/pulse/cookie", env);
+	else
+		return;
+	if ((fp = fopen(path, "rb")) == NULL && !getenv("PULSE_COOKIE") &&
+			(env = getenv("HOME"))) { /* legacy location */
+		snprintf(path, sizeof(path), "%s/.pulse-cookie", env);
+		fp = fopen(path, "rb");
+	}
+	if (fp) {
+		if (fread(cookie, 1, COOKIESIZE, fp) != COOKIESIZE)
+			memset(cookie, 0, COOKIESIZE);
+		fclose(fp);
+	}
+}
+
+
+static int handshake(pavc_State *pavc, const char *name)
+{
+	pavc_Native *n;
+	unsigned char cookie[COOKIESIZE];
+	Request req;
+	Reply r;
+	int err;
+
+	n = getnative(pavc);
+	readcookie(cookie);
+	newrequest(pavc, &req, CMD_AUTH);
+	putu32(&req, PAVC_NATIVEVERSION); /* no shm/memfd flags */
+	putarbitrary(&req, cookie, COOKIESIZE);
+	if ((err = sendrequest(pavc, &req)) < 0 ||
+			(err = waitreply(pavc, req.tag, &r)) < 0)
+		return err;
+	n->version = getu32(&r) & VERSIONMASK;
+	err = r.err;
+	freereply(pavc, &r);
+	if (err || n->version < MINVERSION)
+		return -1;
+	if (n->version > PAVC_NATIVEVERSION)
+		n->version = PAVC_NATIVEVERSION;
+	newrequest(pavc, &req, CMD_SETCLIENTNAME);
+	putbyte(&req, TAG_PROPLIST);
+	putstring(&req, "application.name");
+	putu32(&req, strlen(name) + 1);
+	putarbitrary(&req, name, strlen(name) + 1);
+	putbyte(&req, TAG_STRINGNULL); /* end of proplist */
+	return transact(pavc, &req);
+}
+
+
+int pavc_native_connect(pavc_State *pavc, const char *name)
+{
+	pavc_Native *n;
+	struct sockaddr_un sa;
+	int err;
+
+	n = getnative(pavc);
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	if (pavc_native_socketpath(sa.sun_path, sizeof(sa.sun_path)) < 0)
+		return -1;
+	if ((n->fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return -1;
+	if (connect(n->fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 ||
+			(err = handshake(pavc, name)) == -1) {
+		pavc_native_close(pavc);
+		return -1;
+	}
+	if (err == -2)
+		pavc_state_timeout(pavc, "timed out connecting to the server");
+	return 0;
+}
+
+
+void pavc_native_close(pavc_State *pavc)
+{
+	pavc_Native *n;
+
+	n = getnative(pavc);
+	if (n->fd >= 0) {
+		close(n->fd);
+		n->fd = -1;
+	}
+}
+
+
+static int getsinkinfo(Reply *r, uint32_t version, pa_sink_info *si)
+{
+	uint32_t nports, i;
+	uint8_t nformats;
+
+	memset(si, 0, sizeof(*si));
+	si->index = getu32(r);
+	si->name = getstring(r);
+	si->description = getstring(r);
+	getsamplespec(r, &si->sample_spec);
+	getchannelmap(r, &si->channel_map);
+	si->owner_module = getu32(r);
+	getcvolume(r, &si->volume);
+	si->mute = getbool(r);
+	si->monitor_source = getu32(r);
+	si->monitor_source_name = getstring(r);
+	si->latency = getusec(r);
+	si->driver = getstring(r);
+	si->flags = (pa_sink_flags_t)getu32(r);
+	if (version >= 13) {
+		skipproplist(r);
+		si->configured_latency = getusec(r);
+	}
+	if (version >= 15) {
+		si->base_volume = getvolume(r);
+		si->state = (pa_sink_state_t)getu32(r);
+		si->n_volume_steps = getu32(r);
+		si->card = getu32(r);
+	}
+	if (version >= 16) {
+		nports = getu32(r);
+		for (i = 0; i < nports && !r->err; i++) {
+			getstring(r); /* name */
+			getstring(r); /* description */
+			getu32(r); /* priority */
+			if (version >= 24) {
+				getu32(r); /* available */
+				if (version >= 34) {
+					getstring(r); /* availability group */
+					getu32(r); /* type */
+				}
+			}
+		}
+		getstring(r); /* active port */
+	}
+	if (version >= 21) {
+		nformats = getu8(r);
+		for (i = 0; i < nformats && !r->err; i++)
+			skipformatinfo(r);
+	}
+	return (r->err || si->name == NULL ? -1 : 0);
+}
+
+
+/* 'name' is NULL for all sinks */
+int pavc_native_getsinkinfo(pavc_State *pavc, const char *name, pa_sink_info_cb_t cb, void *ud)
+{
+	pavc_Native *n;
+	pa_sink_info si;
+	Request req;
+	Reply r;
+	int err;
+
+	n = getnative(pavc);
+	if (name) {
+		newrequest(pavc, &req, CMD_GETSINKINFO);
+		putu32(&req, PA_INVALID_INDEX);
+		putstring(&req, name);
+	} else {
+		newrequest(pavc, &req, CMD_GETSINKINFOLIST);
+	}
+	if ((err = sendrequest(pavc, &req)) < 0 ||
+			(err = waitreply(pavc, req.tag, &r)) < 0) {
+		if (err == -1)
+			(*cb)(NULL, NULL, -1, ud);
+		return err;
+	}
+	while (r.p < r.pkt + r.size) {
+		if (getsinkinfo(&r, n->version, &si) < 0) {
+			freereply(pavc, &r);
+			pavc_state_error(pavc, "malformed sink information from the server");
+		}
+		(*cb)(NULL, &si, 0, ud);
+	}
+	freereply(pavc, &r);
+	(*cb)(NULL, NULL, 1, ud);
+	return 0;
+}
+
+
+int pavc_native_setsinkvolume(pavc_State *pavc, uint32_t index, const pa_cvolume *cv)
+{
+	Request req;
+
+	newrequest(pavc, &req, CMD_SETSINKVOLUME);
+	putu32(&req, index);
+	putstring(&req, NULL);
+	putcvolume(&req, cv);
+	return transact(pavc, &req);
+}
+
+
+int pavc_native_setsinkmute(pavc_State *pavc, uint32_t index, int mute)
+{
+	Request req;
+
+	newrequest(pavc, &req, CMD_SETSINKMUTE);
+	putu32(&req, index);
+	putstring(&req, NULL);
+	putbool(&req, mute);
+	return transact(pavc, &req);
+}
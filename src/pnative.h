@@ -0,0 +1,39 @@
+#ifndef PAVCNATIVE_H
+#define PAVCNATIVE_H
+
+
+#include "pcommon.h"
+
+
+/* highest native protocol version spoken by the native backend */
+#define PAVC_NATIVEVERSION	32
+
+
+/* native protocol backend, talks to the server socket directly */
+typedef struct pavc_Native {
+	int fd; /* server socket, -1 if backend is not in use */
+	uint32_t tag; /* tag of the next request */
+	uint32_t version; /* negotiated protocol version */
+	int error; /* error code of the last failed request */
+	pa_usec_t deadline; /* deadline of the current phase (0 if none) */
+} pavc_Native;
+
+
+
+/* get path of the server socket */
+int pavc_native_socketpath(char *buf, size_t size);
+
+/* connect/disconnect (returns -1 if backend can't be used) */
+int pavc_native_connect(pavc_State *pavc, const char *name);
+void pavc_native_close(pavc_State *pavc);
+
+/*
+ * Requests (wait for the reply), callbacks are invoked before returning.
+ * Return 0 on success, -1 if server replied with an error and -2 if the
+ * deadline expired.
+ */
+int pavc_native_getsinkinfo(pavc_State *pavc, const char *name, pa_sink_info_cb_t cb, void *ud);
+int pavc_native_setsinkvolume(pavc_State *pavc, uint32_t index, const pa_cvolume *cv);
+int pavc_native_setsinkmute(pavc_State *pavc, uint32_t index, int mute);
+
+#endif
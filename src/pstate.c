@@ -1,4 +1,5 @@
 #include <pulse/introspect.h>
+#include <pulse/rtclock.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -9,6 +10,16 @@
 #define STATESIZE	sizeof(pavc_State)
 
 
+/* true if connected using the native backend */
+#define usenative(pavc)		((pavc)->native.fd >= 0)
+
+
+/* 'nativeop' values */
+#define NATIVENONE	0
+#define NATIVEDONE	1 /* request completed */
+#define NATIVEEXPIRED	2 /* request deadline expired */
+
+
 pavc_State *pavc_state_new(pavc_Allocfunction fn, void *ud)
 {
 	pavc_State *pavc;
@@ -20,18 +31,45 @@ pavc_State *pavc_state_new(pavc_Allocfunction fn, void *ud)
 	pavc->ml = NULL;
 	pavc->mlapi = NULL;
 	pavc->op = NULL;
+	pavc->ops = NULL;
+	pavc->nops = 0;
+	pavc->sizeops = 0;
 	pavc->ctx = NULL;
+	pavc->deadline = NULL;
 	pavc->si = NULL;
 	pavc->nsi = 0;
 	pavc->sizesi = 0;
+	memset(&pavc->cache, 0, sizeof(pavc->cache));
+	memset(&pavc->meters, 0, sizeof(pavc->meters));
+	memset(&pavc->native, 0, sizeof(pavc->native));
+	memset(&pavc->links, 0, sizeof(pavc->links));
+	memset(&pavc->batch, 0, sizeof(pavc->batch));
+	pavc->native.fd = -1;
 	pavc->running = 0;
+	pavc->expired = 0;
+	pavc->nativeop = NATIVENONE;
 	return pavc;
 }
 
 
+static void freesinkinfo(pavc_State *pavc, const pa_sink_info *si)
+{
+	if (si->name)
+		pavc_mem_free(pavc, (void*)si->name, strlen(si->name) + 1);
+	if (si->monitor_source_name)
+		pavc_mem_free(pavc, (void*)si->monitor_source_name,
+				strlen(si->monitor_source_name) + 1);
+	pavc_mem_free(pavc, (void*)si, sizeof(*si));
+}
+
+
 void pavc_state_delete(pavc_State *pavc)
 {
+        pavc_native_close(pavc);
         if (pavc->ml) {
+                pavc_meter_free(pavc);
+                if (pavc->deadline)
+                        pavc->mlapi->time_free(pavc->deadline);
                 if (pavc->ctx) {
                         if(pa_context_get_state(pavc->ctx) == PA_CONTEXT_READY)
                                 pa_context_disconnect(pavc->ctx);
@@ -39,14 +77,22 @@ void pavc_state_delete(pavc_State *pavc)
                 } 
                 if (pavc->op)
                         pa_operation_unref(pavc->op);
+                pavc_state_freedetached(pavc);
                 if (pavc->running) {
 			pa_threaded_mainloop_unlock(pavc->ml);
                         pa_threaded_mainloop_stop(pavc->ml);
                 }
                 pa_threaded_mainloop_free(pavc->ml);
         }
+        while (pavc->nsi > 0)
+                freesinkinfo(pavc, pavc->si[--pavc->nsi]);
         if (pavc->si)
                 pavc_mem_freearray(pavc, pavc->si, pavc->sizesi);
+        pavc_cache_free(pavc);
+        pavc_link_free(pavc);
+        pavc_volume_freebatch(pavc);
+        if (pavc->ops)
+                pavc_mem_freearray(pavc, pavc->ops, pavc->sizeops);
 	pavc->alloc(pavc, pavc->ud, STATESIZE, 0);
 }
 
@@ -59,11 +105,25 @@ static inline void printerror(const char *err)
 }
 
 
-p_noret pavc_state_error(pavc_State *pavc, const char* err) 
+static p_noret errorexit(pavc_State *pavc, const char *err, int status)
 {
 	printerror(err);
+	if (pavc->running && pa_threaded_mainloop_in_thread(pavc->ml))
+		exit(status); /* event loop thread can't stop itself */
 	pavc_state_delete(pavc);
-	exit(EXIT_FAILURE);
+	exit(status);
+}
+
+
+p_noret pavc_state_error(pavc_State *pavc, const char* err) 
+{
+	errorexit(pavc, err, EXIT_FAILURE);
+}
+
+
+p_noret pavc_state_timeout(pavc_State *pavc, const char* err) 
+{
+	errorexit(pavc, err, PAVC_EXITTIMEOUT);
 }
 
 
@@ -125,6 +185,63 @@ void pavc_state_unlockthreadedml(pavc_State *pavc)
 }
 
 
+static void deadlinecb(pa_mainloop_api *api, pa_time_event *e,
+			const struct timeval *tv, void *ud)
+{
+	pavc_State *pavc;
+
+	UNUSED(api);
+	UNUSED(e);
+	UNUSED(tv);
+	pavc = (pavc_State*)ud;
+	pavc->expired = 1;
+	pa_threaded_mainloop_signal(pavc->ml, 0);
+}
+
+
+/* arm (or re-arm) the deadline 'msec' milliseconds from now */
+void pavc_state_setdeadline(pavc_State *pavc, unsigned int msec)
+{
+	pa_usec_t usec;
+
+	if (usenative(pavc)) {
+		pavc->native.deadline = (msec ? pa_rtclock_now() + msec * PA_USEC_PER_MSEC : 0);
+		pavc->expired = 0;
+		return;
+	}
+	pavc_assert(pavc->ctx);
+	if (msec == 0) {
+		pavc_state_cleardeadline(pavc);
+		return;
+	}
+	pavc->expired = 0;
+	usec = pa_rtclock_now() + msec * PA_USEC_PER_MSEC;
+	if (pavc->deadline)
+		pa_context_rttime_restart(pavc->ctx, pavc->deadline, usec);
+	else if ((pavc->deadline = pa_context_rttime_new(pavc->ctx, usec, deadlinecb, pavc)) == NULL)
+		pavc_state_error(pavc, "couldn't create deadline timer");
+}
+
+
+void pavc_state_cleardeadline(pavc_State *pavc)
+{
+	pavc->native.deadline = 0;
+	if (pavc->deadline) {
+		pavc->mlapi->time_free(pavc->deadline);
+		pavc->deadline = NULL;
+	}
+	pavc->expired = 0;
+}
+
+
+int pavc_state_expired(pavc_State *pavc)
+{
+	if (usenative(pavc) && pavc->native.deadline && pa_rtclock_now() >= pavc->native.deadline)
+		pavc->expired = 1;
+	return pavc->expired;
+}
+
+
 void pavc_state_waitctxstate(pavc_State *pavc, pa_context_state_t state)
 {
         pa_context_state_t currstate;
@@ -132,26 +249,36 @@ void pavc_state_waitctxstate(pavc_State *pavc, pa_context_state_t state)
 	pavc_assert(pavc->ml);
 	pavc_assert(pavc->ctx);
         while((currstate = pa_context_get_state(pavc->ctx)) != state) {
-		if (currstate != PA_CONTEXT_FAILED)
-			pa_threaded_mainloop_wait(pavc->ml);
-		else
+		if (currstate == PA_CONTEXT_FAILED)
 			pavc_state_error(pavc, "connection failed or was disconnected");
+		else if (pavc->expired)
+			pavc_state_timeout(pavc, "timed out connecting to the server");
+		else
+			pa_threaded_mainloop_wait(pavc->ml);
         }
 }
 
 
-void pavc_state_waitopstate(pavc_State *pavc, pa_operation_state_t state)
+/* returns -1 if the deadline expired, operation is then cancelled */
+int pavc_state_waitopstate(pavc_State *pavc, pa_operation_state_t state)
 {
 	pa_operation_state_t currstate;
 
+	if (pavc->nativeop != NATIVENONE) /* native requests complete in place */
+		return (pavc->nativeop == NATIVEEXPIRED ? -1 : 0);
 	pavc_assert(pavc->ml);
 	pavc_assert(pavc->op);
 	while ((currstate = pa_operation_get_state(pavc->op)) != state) {
-		if (currstate != PA_OPERATION_CANCELLED)
-			pa_threaded_mainloop_wait(pavc->ml);
-		else
+		if (currstate == PA_OPERATION_CANCELLED) {
 			pavc_state_error(pavc, "operation failed");
+		} else if (pavc->expired) {
+			pa_operation_cancel(pavc->op);
+			return -1;
+		} else {
+			pa_threaded_mainloop_wait(pavc->ml);
+		}
 	}
+	return 0;
 }
 
 
@@ -164,32 +291,140 @@ void pavc_state_connect(pavc_State *pavc, pavc_Statechangecb cb, void *ud,
 }
 
 
+/*
+ * Connect using the native backend instead of libpulse context (no event
+ * loop is created). Returns -1 if backend can't be used.
+ */
+int pavc_state_connectnative(pavc_State *pavc, const char *name, unsigned int msec)
+{
+	pavc->native.deadline = (msec ? pa_rtclock_now() + msec * PA_USEC_PER_MSEC : 0);
+	return pavc_native_connect(pavc, name);
+}
+
+
+/* true if libpulse context is connecting or connected */
+int pavc_state_connected(pavc_State *pavc)
+{
+	if (usenative(pavc))
+		return 1;
+	pavc_assert(pavc->ctx);
+	return PA_CONTEXT_IS_GOOD(pa_context_get_state(pavc->ctx));
+}
+
+
+static void nativeresult(pavc_State *pavc, int res)
+{
+	pavc->nativeop = (res == -2 ? NATIVEEXPIRED : NATIVEDONE);
+}
+
+
 int pavc_state_haveop(pavc_State *pavc)
 {
-	return (pavc->op != NULL);
+	return (pavc->op != NULL || pavc->nativeop != NATIVENONE);
 }
 
 
 void pavc_state_removeop(pavc_State *pavc)
 {
+	if (pavc->nativeop != NATIVENONE) {
+		pavc->nativeop = NATIVENONE;
+		return;
+	}
 	pavc_assert(pavc->op);
 	pa_operation_unref(pavc->op);
 	pavc->op = NULL;
 }
 
 
+pa_operation *pavc_state_takeop(pavc_State *pavc)
+{
+	pa_operation *op;
+
+	pavc_assert(pavc->op);
+	op = pavc->op;
+	pavc->op = NULL;
+	return op;
+}
+
+
+/* operations that are no longer running are released first, so only
+ * the ones in flight are kept */
+void pavc_state_detachop(pavc_State *pavc)
+{
+	unsigned int i, n;
+
+	if (pavc->nativeop != NATIVENONE) { /* already completed */
+		pavc->nativeop = NATIVENONE;
+		return;
+	}
+	pavc_assert(pavc->op);
+	for (i = n = 0; i < pavc->nops; i++) {
+		if (pa_operation_get_state(pavc->ops[i]) == PA_OPERATION_RUNNING)
+			pavc->ops[n++] = pavc->ops[i];
+		else
+			pa_operation_unref(pavc->ops[i]);
+	}
+	pavc->nops = n;
+	pavc_mem_growarray(pavc, pavc->ops, &pavc->sizeops, pavc->nops, UINT_MAX,
+				pa_operation*);
+	pavc->ops[pavc->nops++] = pavc->op;
+	pavc->op = NULL;
+}
+
+
+/* cancel detached operations that are still running and unref all */
+void pavc_state_freedetached(pavc_State *pavc)
+{
+	pa_operation *op;
+
+	while (pavc->nops > 0) {
+		op = pavc->ops[--pavc->nops];
+		if (pa_operation_get_state(op) == PA_OPERATION_RUNNING)
+			pa_operation_cancel(op);
+		pa_operation_unref(op);
+	}
+}
+
+
 void pavc_state_signalthreadedml(pavc_State *pavc, int sig)
+{
+	if (pavc->ml) /* no event loop with native backend */
+		pa_threaded_mainloop_signal(pavc->ml, sig);
+}
+
+
+void pavc_state_waitthreadedml(pavc_State *pavc)
 {
 	pavc_assert(pavc->ml);
-	pa_threaded_mainloop_signal(pavc->ml, sig);
+	pa_threaded_mainloop_wait(pavc->ml);
 }
 
 
+/*
+ * 'si' is only valid for the duration of the callback it was received in,
+ * so a copy is stored; strings other than the names and all of the nested
+ * structures (ports, formats, proplist) are not kept.
+ */
 void pavc_state_addsinkinfo(pavc_State *pavc, const pa_sink_info *si)
 {
+	pa_sink_info *copy;
+
 	pavc_mem_growarray(pavc, pavc->si, &pavc->sizesi, pavc->nsi, UINT_MAX,
 				const pa_sink_info*);
-	pavc->si[pavc->nsi++] = si;
+	copy = (pa_sink_info*)pavc_mem_malloc(pavc, sizeof(*copy));
+	*copy = *si;
+	copy->name = (si->name ? pavc_mem_strdup(pavc, si->name) : NULL);
+	copy->monitor_source_name = (si->monitor_source_name ?
+			pavc_mem_strdup(pavc, si->monitor_source_name) : NULL);
+	copy->description = NULL;
+	copy->driver = NULL;
+	copy->proplist = NULL;
+	copy->n_ports = 0;
+	copy->ports = NULL;
+	copy->active_port = NULL;
+	copy->n_formats = 0;
+	copy->formats = NULL;
+	pavc->si[pavc->nsi++] = copy;
 }
 
 
@@ -214,6 +449,14 @@ const pa_sink_info *pavc_state_getlastsinkinfo(pavc_State *pavc)
 void pavc_state_setsinkvolumeindex(pavc_State *pavc, const pa_sink_info *si, pa_cvolume *cvnew,
 					pavc_Ctxsuccesscb cb, void *ud)
 {
+	int res;
+
+	if (usenative(pavc)) {
+		res = pavc_native_setsinkvolume(pavc, si->index, cvnew);
+		if (res != -2) (*cb)(NULL, res == 0, ud);
+		nativeresult(pavc, res);
+		return;
+	}
 	pavc_assert(pavc->ctx); /* must be connected */
 	pavc->op = pa_context_set_sink_volume_by_index(pavc->ctx, si->index, cvnew, cb, ud);
 	pavc_assert(pavc->op != NULL);
@@ -223,6 +466,14 @@ void pavc_state_setsinkvolumeindex(pavc_State *pavc, const pa_sink_info *si, pa_
 void pavc_state_setsinkmuteindex(pavc_State *pavc, const pa_sink_info *si, int mute,
 					pavc_Ctxsuccesscb cb, void *ud)
 {
+	int res;
+
+	if (usenative(pavc)) {
+		res = pavc_native_setsinkmute(pavc, si->index, mute);
+		if (res != -2) (*cb)(NULL, res == 0, ud);
+		nativeresult(pavc, res);
+		return;
+	}
 	pavc_assert(pavc->ctx); /* must be connected */
 	pavc->op = pa_context_set_sink_mute_by_index(pavc->ctx, si->index, mute, cb, ud);
 }
@@ -230,6 +481,10 @@ void pavc_state_setsinkmuteindex(pavc_State *pavc, const pa_sink_info *si, int m
 
 void pavc_state_getsinkinfolist(pavc_State *pavc, pavc_Sinkinfocb cb, void *ud)
 {
+	if (usenative(pavc)) {
+		nativeresult(pavc, pavc_native_getsinkinfo(pavc, NULL, cb, ud));
+		return;
+	}
 	pavc_assert(pavc->ctx); /* must be connected */
 	pavc->op = pa_context_get_sink_info_list(pavc->ctx, cb, ud);
 	pavc_assert(pavc->op != NULL);
@@ -238,31 +493,33 @@ void pavc_state_getsinkinfolist(pavc_State *pavc, pavc_Sinkinfocb cb, void *ud)
 
 void pavc_state_getsinkinfoname(pavc_State *pavc, const char *name, pavc_Sinkinfocb cb, void *ud)
 {
+	if (usenative(pavc)) {
+		nativeresult(pavc, pavc_native_getsinkinfo(pavc, name, cb, ud));
+		return;
+	}
 	pavc_assert(pavc->ctx); /* must be connected */
 	pavc->op = pa_context_get_sink_info_by_name(pavc->ctx, name, cb, ud);
 	pavc_assert(pavc->op != NULL);
 }
 
 
-const pa_sink_info *pavc_state_removelastsinkinfo(pavc_State *pavc)
+/* event loop only (native backend doesn't look up sinks by index) */
+void pavc_state_getsinkinfoindex(pavc_State *pavc, uint32_t index, pavc_Sinkinfocb cb, void *ud)
 {
-	return (pavc->nsi > 0 ? pavc->si[--pavc->nsi] : NULL);
+	pavc_assert(pavc->ctx); /* must be connected */
+	pavc->op = pa_context_get_sink_info_by_index(pavc->ctx, index, cb, ud);
+	pavc_assert(pavc->op != NULL);
 }
 
 
-const pa_sink_info *pavc_state_removesinkinfoindex(pavc_State *pavc, unsigned int i)
+/* event loop only, native backend has no subscriptions */
+void pavc_state_subscribe(pavc_State *pavc, pa_subscription_mask_t mask, pavc_Eventcb eventcb,
+				pavc_Ctxsuccesscb cb, void *ud)
 {
-	const pa_sink_info *si;
-
-	if (i < pavc->nsi) {
-		if (i == pavc->nsi - 1)
-			return pavc_state_removelastsinkinfo(pavc);
-		si = pavc->si[i];
-		memmove(&pavc->si[i], &pavc->si[i + 1], pavc->nsi - i - 1);
-		pavc->nsi--;
-		return si;
-	}
-	return NULL;
+	pavc_assert(pavc->ctx); /* must be connected */
+	pa_context_set_subscribe_callback(pavc->ctx, eventcb, ud);
+	pavc->op = pa_context_subscribe(pavc->ctx, mask, cb, ud);
+	pavc_assert(pavc->op != NULL);
 }
 
 
@@ -270,6 +527,8 @@ const char *pavc_state_getoperrormsg(pavc_State *pavc)
 {
 	int errcode;
 
+	if (usenative(pavc))
+		return pa_strerror(pavc->native.error);
 	pavc_assert(pavc->ctx);
 	errcode = pa_context_errno(pavc->ctx);
 	return pa_strerror(errcode);
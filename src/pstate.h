@@ -3,6 +3,11 @@
 
 
 #include "pcommon.h"
+#include "pcache.h"
+#include "pmeter.h"
+#include "pnative.h"
+#include "plink.h"
+#include "pvolume.h"
 
 
 /* state change callback */
@@ -14,6 +19,9 @@ typedef void (*pavc_Ctxsuccesscb)(pa_context *, int, void*);
 /* sink info callback */
 typedef void (*pavc_Sinkinfocb)(pa_context *, const pa_sink_info *, int, void *);
 
+/* subscription event callback */
+typedef void (*pavc_Eventcb)(pa_context *, pa_subscription_event_type_t, uint32_t, void *);
+
 
 struct pavc_State {
 	pavc_Allocfunction alloc; /* allocator */
@@ -21,11 +29,22 @@ struct pavc_State {
         pa_threaded_mainloop* ml;
         pa_mainloop_api* mlapi;
         pa_operation* op;
+        pa_operation** ops; /* detached operations */
+        unsigned int nops; /* number of elements in 'ops' */
+        unsigned int sizeops; /* size of 'ops' */
         pa_context* ctx;
+        pa_time_event* deadline; /* current phase deadline */
         const pa_sink_info** si;
         unsigned int nsi; /* number of elements in 'si' */
         unsigned int sizesi; /* size of 'si' */
+        pavc_Cache cache; /* sink metadata cache */
+        pavc_Meters meters; /* sink level meters */
+        pavc_Native native; /* native protocol backend */
+        pavc_Links links; /* linked sink groups */
+        pavc_Volbatch batch; /* volumes computed in one pass */
         unsigned char running; /* true if mainloopo is running */
+        unsigned char expired; /* true if 'deadline' expired */
+        unsigned char nativeop; /* state of the last native backend request */
 };
 
 
@@ -41,43 +60,64 @@ void pavc_state_startthreadedml(pavc_State *pavc);
 void pavc_state_lockthreadedml(pavc_State *pavc);
 void pavc_state_unlockthreadedml(pavc_State *pavc);
 void pavc_state_signalthreadedml(pavc_State *pavc, int sig);
+void pavc_state_waitthreadedml(pavc_State *pavc);
 void pavc_state_getthreadedmlapi(pavc_State *pavc);
 void pavc_state_newcontext(pavc_State *pavc, const char *name);
 
 
+/* (event loop) deadline of the current phase */
+void pavc_state_setdeadline(pavc_State *pavc, unsigned int msec);
+void pavc_state_cleardeadline(pavc_State *pavc);
+int pavc_state_expired(pavc_State *pavc);
+
+
 /* (event loop) wait on states */
 void pavc_state_waitctxstate(pavc_State *pavc, pa_context_state_t state);
-void pavc_state_waitopstate(pavc_State *pavc, pa_operation_state_t state);
+int pavc_state_waitopstate(pavc_State *pavc, pa_operation_state_t state);
 
 
 /* check/unref current operation (no PulseAudio operations) */
 int pavc_state_haveop(pavc_State *pavc);
 void pavc_state_removeop(pavc_State *pavc);
 
+/* take over current operation, caller unrefs it */
+pa_operation *pavc_state_takeop(pavc_State *pavc);
+
+/* (event loop) keep current operation without waiting on it, so it can
+ * be cancelled later if it is still running (finished ones are released) */
+void pavc_state_detachop(pavc_State *pavc);
+void pavc_state_freedetached(pavc_State *pavc);
+
 
 /* operates on pavc_State sink array (no PulseAudio operations) */
 void pavc_state_addsinkinfo(pavc_State *pavc, const pa_sink_info *si);
 const pa_sink_info *pavc_state_getsinkinfo(pavc_State *pavc, unsigned int i);
 const pa_sink_info *pavc_state_getlastsinkinfo(pavc_State *pavc);
-const pa_sink_info *pavc_state_removelastsinkinfo(pavc_State *pavc);
-const pa_sink_info *pavc_state_removesinkinfoindex(pavc_State *pavc, unsigned int i);
 unsigned int pavc_state_getsinkcount(pavc_State *pavc);
 
 /* fill pavc_State sink array (performs PulseAudio operation) */
 void pavc_state_getsinkinfoname(pavc_State *pavc, const char *name, pavc_Sinkinfocb cb, void *ud);
+void pavc_state_getsinkinfoindex(pavc_State *pavc, uint32_t index, pavc_Sinkinfocb cb, void *ud);
 void pavc_state_getsinkinfolist(pavc_State *pavc, pavc_Sinkinfocb cb, void *ud);
 void pavc_state_setsinkvolumeindex(pavc_State *pavc, const pa_sink_info *si, pa_cvolume *cvnew, pavc_Ctxsuccesscb cb, void *ud);
 void pavc_state_setsinkmuteindex(pavc_State *pavc, const pa_sink_info *si, int mute, pavc_Ctxsuccesscb cb, void *ud);
 
+/* subscribe to server events (performs PulseAudio operation) */
+void pavc_state_subscribe(pavc_State *pavc, pa_subscription_mask_t mask, pavc_Eventcb eventcb,
+			pavc_Ctxsuccesscb cb, void *ud);
+
 /* retrieve latest operation error */
 const char *pavc_state_getoperrormsg(pavc_State *pavc);
 
 /* connect to PulseAudio server */
 void pavc_state_connect(pavc_State *pavc, pavc_Statechangecb cb, void *ud, const char *server, pa_context_flags_t flags, const pa_spawn_api *api);
+int pavc_state_connectnative(pavc_State *pavc, const char *name, unsigned int msec);
+int pavc_state_connected(pavc_State *pavc);
 
 
 /* throw error */
 p_noret pavc_state_error(pavc_State *pavc, const char *err);
+p_noret pavc_state_timeout(pavc_State *pavc, const char *err);
 const char *pavc_state_checkerror(pavc_State *pavc);
 
 #endif
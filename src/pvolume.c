@@ -0,0 +1,69 @@
+#include "pvolume.h"
+#include "pstate.h"
+#include "pmem.h"
+
+
+#define getbatch(pavc)		(&(pavc)->batch)
+
+
+
+pavc_Volbatch *pavc_volume_newbatch(pavc_State *pavc, unsigned int n)
+{
+	pavc_Volbatch *b;
+
+	pavc_volume_freebatch(pavc);
+	b = getbatch(pavc);
+	if (n == 0)
+		return b;
+	b->v = (float*)pavc_mem_malloc(pavc, n * sizeof(float));
+	b->mul = (float*)pavc_mem_malloc(pavc, n * sizeof(float));
+	b->add = (float*)pavc_mem_malloc(pavc, n * sizeof(float));
+	b->n = n;
+	return b;
+}
+
+
+void pavc_volume_freebatch(pavc_State *pavc)
+{
+	pavc_Volbatch *b;
+
+	b = getbatch(pavc);
+	if (b->n > 0) {
+		pavc_mem_free(pavc, b->v, b->n * sizeof(float));
+		pavc_mem_free(pavc, b->mul, b->n * sizeof(float));
+		pavc_mem_free(pavc, b->add, b->n * sizeof(float));
+	}
+	b->v = b->mul = b->add = NULL;
+	b->n = 0;
+}
+
+
+/*
+ * Both 'set' (mul 0, add level) and 'balance' (mul side factor, add 0)
+ * reduce to this, branch free so it compiles to multiply, add and
+ * min/max over whole vectors of channels regardless of sink boundaries.
+ */
+void pavc_volume_apply(float *restrict v, const float *restrict mul,
+			const float *restrict add, size_t n, float hi)
+{
+	size_t k;
+	float x;
+
+	for (k = 0; k < n; k++) {
+		x = v[k] * mul[k] + add[k];
+		x = (x > 0.0f ? x : 0.0f);
+		v[k] = (x < hi ? x : hi);
+	}
+}
+
+
+void pavc_volume_tocvolume(const float *v, pa_cvolume *cv)
+{
+	unsigned int j;
+	float x;
+
+	for (j = 0; j < cv->channels; j++) {
+		x = v[j] + 0.5f;
+		cv->values[j] = (x >= (float)PA_VOLUME_MAX ? PA_VOLUME_MAX : (pa_volume_t)x);
+	}
+}
@@ -0,0 +1,32 @@
+#ifndef PAVCVOLUME_H
+#define PAVCVOLUME_H
+
+
+#include "pcommon.h"
+
+
+/*
+ * Channels of every sink in a batch laid out back to back, one array per
+ * operand, so a single kernel call computes the new volume of all of them.
+ */
+typedef struct pavc_Volbatch {
+	float *v; /* current volume, new volume once applied */
+	float *mul; /* factor */
+	float *add; /* offset (applied after 'mul') */
+	unsigned int n; /* number of channels */
+} pavc_Volbatch;
+
+
+
+/* allocate/free batch of 'n' channels */
+pavc_Volbatch *pavc_volume_newbatch(pavc_State *pavc, unsigned int n);
+void pavc_volume_freebatch(pavc_State *pavc);
+
+/* v = clamp(v * mul + add, 0, hi) */
+void pavc_volume_apply(float *restrict v, const float *restrict mul,
+			const float *restrict add, size_t n, float hi);
+
+/* convert 'cv->channels' applied volumes back */
+void pavc_volume_tocvolume(const float *v, pa_cvolume *cv);
+
+#endif